@@ -19,9 +19,28 @@
 
 #include <iostream>
 #include <fstream>
+#include <signal.h>
 
 #include "dcache.H"
 #include "pin_profile.H"
+#include "access_pattern.H"
+#include "store_buffer.H"
+#include "alloc_sites.H"
+#include "numa.H"
+#include "mem_tier.H"
+#include "hot_lines.H"
+#include "hyperloglog.H"
+#include "sharing.H"
+#include "field_heat.H"
+#include "addr_remap.H"
+#include "oracle.H"
+#include "atd.H"
+#include "umon.H"
+#include "live_stats.H"
+#include "trace_recorder.H"
+#include "ref_ring.H"
+#include "clone_profile.H"
+#include "miss_profile.H"
 using std::ostringstream;
 using std::string;
 using std::cerr;
@@ -40,15 +59,123 @@ KNOB<BOOL>   KnobTrackLoads(KNOB_MODE_WRITEONCE,    "pintool",
 KNOB<BOOL>   KnobTrackStores(KNOB_MODE_WRITEONCE,   "pintool",
    "ts", "0", "track individual stores -- increases profiling time");
 KNOB<UINT32> KnobThresholdHit(KNOB_MODE_WRITEONCE , "pintool",
-   "rh", "100", "only report memops with hit count above threshold");
+   "rh", "100", "only report memops with hit count above threshold (all rows with -follow)");
 KNOB<UINT32> KnobThresholdMiss(KNOB_MODE_WRITEONCE, "pintool",
-   "rm","100", "only report memops with miss count above threshold");
+   "rm","100", "only report memops with miss count above threshold (all rows with -follow)");
 KNOB<UINT32> KnobCacheSize(KNOB_MODE_WRITEONCE, "pintool",
     "c","32", "cache size in kilobytes");
 KNOB<UINT32> KnobLineSize(KNOB_MODE_WRITEONCE, "pintool",
     "b","32", "cache block size in bytes");
 KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
     "a","4", "cache associativity (1 for direct mapped)");
+KNOB<BOOL>   KnobAccessPattern(KNOB_MODE_WRITEONCE, "pintool",
+    "pattern","0", "classify the address stream of tracked loads/stores");
+KNOB<BOOL>   KnobWriteValidate(KNOB_MODE_WRITEONCE, "pintool",
+    "wv","0", "count store-miss fills that are fully overwritten (avoidable RFOs)");
+KNOB<UINT32> KnobStoreBuffer(KNOB_MODE_WRITEONCE, "pintool",
+    "sb","0", "store buffer entries per thread in front of the cache (0 for none)");
+KNOB<UINT32> KnobStoreBufferDrain(KNOB_MODE_WRITEONCE, "pintool",
+    "sb_drain","2", "memory references per store drained from the store buffer");
+KNOB<UINT32> KnobWriteCombining(KNOB_MODE_WRITEONCE, "pintool",
+    "wcb","0", "write-combining buffers per thread for non-temporal stores, which drop their lines from dl1 (0 for none)");
+KNOB<UINT32> KnobPageSize(KNOB_MODE_WRITEONCE, "pintool",
+    "page","4096", "page size in bytes for page granularity models");
+KNOB<UINT32> KnobNumaNodes(KNOB_MODE_WRITEONCE, "pintool",
+    "numa","0", "NUMA nodes behind the cache (0 disables the NUMA model)");
+KNOB<string> KnobNumaPolicy(KNOB_MODE_WRITEONCE, "pintool",
+    "numa_policy","first-touch", "page placement: first-touch, interleave or bind");
+KNOB<UINT32> KnobNumaBindNode(KNOB_MODE_WRITEONCE, "pintool",
+    "numa_bind","0", "node used by the bind policy");
+KNOB<string> KnobNumaThreads(KNOB_MODE_WRITEONCE, "pintool",
+    "numa_threads","", "comma separated node of each thread id, default round-robin");
+KNOB<UINT64> KnobTierNearPages(KNOB_MODE_WRITEONCE, "pintool",
+    "tier_near","0", "near memory capacity in pages (0 disables the tiering model)");
+KNOB<string> KnobTierPolicy(KNOB_MODE_WRITEONCE, "pintool",
+    "tier_policy","hotness", "page migration policy: static, on-demand or hotness");
+KNOB<UINT64> KnobTierEpoch(KNOB_MODE_WRITEONCE, "pintool",
+    "tier_epoch","100000", "memory accesses per tiering epoch (hotness decay, report interval)");
+KNOB<UINT32> KnobTierThreshold(KNOB_MODE_WRITEONCE, "pintool",
+    "tier_threshold","8", "hotness a far page needs to be promoted by the hotness policy");
+KNOB<UINT32> KnobHotLines(KNOB_MODE_WRITEONCE, "pintool",
+    "hot","0", "report the N most frequently missing lines and pages (0 for none)");
+KNOB<UINT32> KnobHotSketchWidth(KNOB_MODE_WRITEONCE, "pintool",
+    "hot_width","16384", "counters per row of the hot line count-min sketch");
+KNOB<UINT64> KnobWorkingSet(KNOB_MODE_WRITEONCE, "pintool",
+    "ws","0", "estimate distinct lines/pages every N references (0 for never)");
+KNOB<UINT32> KnobWorkingSetPrecision(KNOB_MODE_WRITEONCE, "pintool",
+    "ws_precision","10", "log2 of the HyperLogLog register count");
+KNOB<string> KnobMissRatioCurves(KNOB_MODE_WRITEONCE, "pintool",
+    "mrc","", "comma separated line sizes to build miss-ratio curves for in one pass, e.g. 32,64,128");
+KNOB<UINT64> KnobMissRatioCurvesMax(KNOB_MODE_WRITEONCE, "pintool",
+    "mrc_max","65536", "largest cache size in KB of the miss-ratio curves");
+KNOB<BOOL>   KnobSharing(KNOB_MODE_WRITEONCE, "pintool",
+    "share","0", "count producer-consumer transfers between threads");
+KNOB<UINT32> KnobFieldHeat(KNOB_MODE_WRITEONCE, "pintool",
+    "fields","0", "report per-offset heat of the N heap allocation sites with the largest objects");
+KNOB<UINT32> KnobFieldGranularity(KNOB_MODE_WRITEONCE, "pintool",
+    "fields_gran","8", "bytes per field heat bucket");
+KNOB<UINT32> KnobFieldMaxOffset(KNOB_MODE_WRITEONCE, "pintool",
+    "fields_max","4096", "object offsets tracked by field heat, larger offsets share the last bucket");
+KNOB<string> KnobRemap(KNOB_MODE_WRITEONCE, "pintool",
+    "remap","", "file of what-if address remapping rules applied before the cache");
+KNOB<string> KnobOracle(KNOB_MODE_WRITEONCE, "pintool",
+    "oracle","", "file of instructions, routines and ranges that always hit (perfect-cache oracle)");
+KNOB<BOOL>   KnobOracleFill(KNOB_MODE_WRITEONCE, "pintool",
+    "oracle_fill","0", "perfect references still allocate in the cache");
+KNOB<UINT32> KnobHitLatency(KNOB_MODE_WRITEONCE, "pintool",
+    "hit_latency","4", "cycles per dl1 hit in cycle estimates");
+KNOB<UINT32> KnobMissLatency(KNOB_MODE_WRITEONCE, "pintool",
+    "miss_latency","100", "cycles per dl1 miss in cycle estimates");
+KNOB<UINT32> KnobSampleSets(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_sets","1", "simulate about one cache set in N and scale the stats (1 for all sets)");
+KNOB<string> KnobShadowPolicies(KNOB_MODE_WRITEONCE, "pintool",
+    "atd","", "comma separated shadow tag directory policies: lru, plru, rrip, random");
+KNOB<UINT32> KnobShadowSets(KNOB_MODE_WRITEONCE, "pintool",
+    "atd_sets","32", "shadow tag directories keep about one set in N");
+KNOB<UINT64> KnobUtilityMonitor(KNOB_MODE_WRITEONCE, "pintool",
+    "umon","0", "per-thread utility monitors, partition every N dl1 accesses (0 for none)");
+KNOB<UINT32> KnobUtilityMonitorSets(KNOB_MODE_WRITEONCE, "pintool",
+    "umon_sets","32", "utility monitors keep about one set in N");
+KNOB<BOOL>   KnobFollow(KNOB_MODE_WRITEONCE, "pintool",
+    "follow","0", "follow fork and exec, every process writes its own <o>.<pid>");
+KNOB<BOOL>   KnobForkInherit(KNOB_MODE_WRITEONCE, "pintool",
+    "fork_inherit","0", "forked children start with the parent's warm cache instead of a cold one");
+KNOB<string> KnobLive(KNOB_MODE_WRITEONCE, "pintool",
+    "live","", "publish live counters to this memory-mapped file, SIGUSR1 writes a snapshot report");
+KNOB<UINT32> KnobLivePeriod(KNOB_MODE_WRITEONCE, "pintool",
+    "live_ms","1000", "milliseconds between live counter updates");
+KNOB<BOOL>   KnobLiveReset(KNOB_MODE_WRITEONCE, "pintool",
+    "live_reset","0", "reset the counters after every snapshot report");
+KNOB<string> KnobStopRoutine(KNOB_MODE_WRITEONCE, "pintool",
+    "stop_rtn","", "write the stats and detach when this routine is first entered");
+KNOB<UINT64> KnobStopInstructions(KNOB_MODE_WRITEONCE, "pintool",
+    "stop_icount","0", "write the stats and detach after N executed instructions (0 for never)");
+KNOB<BOOL>   KnobStopMarker(KNOB_MODE_WRITEONCE, "pintool",
+    "stop_marker","0", "write the stats and detach at the first xchg bx,bx marker");
+KNOB<string> KnobTrace(KNOB_MODE_WRITEONCE, "pintool",
+    "trace","", "record every load and store into this chunk-indexed trace for dcache_replay");
+KNOB<UINT32> KnobTraceChunk(KNOB_MODE_WRITEONCE, "pintool",
+    "trace_chunk","65536", "references per trace chunk");
+KNOB<string> KnobMissTrace(KNOB_MODE_WRITEONCE, "pintool",
+    "miss_trace","", "record only dl1 misses, dirty writebacks and prefetch misses into this trace");
+KNOB<string> KnobRing(KNOB_MODE_WRITEONCE, "pintool",
+    "ring","", "publish every load and store to the consumers of this shared-memory ring file");
+KNOB<UINT32> KnobRingRefs(KNOB_MODE_WRITEONCE, "pintool",
+    "ring_refs","1048576", "references the ring holds, rounded up to a power of two");
+KNOB<UINT32> KnobRingBatch(KNOB_MODE_WRITEONCE, "pintool",
+    "ring_batch","4096", "references a thread collects before publishing them");
+KNOB<UINT32> KnobRingWait(KNOB_MODE_WRITEONCE, "pintool",
+    "ring_wait","0", "start the program once this many ring consumers are attached");
+KNOB<string> KnobClone(KNOB_MODE_WRITEONCE, "pintool",
+    "clone","", "write a statistical profile for dcache_clone to synthesize a proxy stream from");
+KNOB<string> KnobPprof(KNOB_MODE_WRITEONCE, "pintool",
+    "pprof","", "write dl1 accesses, misses, writebacks and stall cycles per instruction as a pprof profile");
+KNOB<string> KnobFolded(KNOB_MODE_WRITEONCE, "pintool",
+    "folded","", "write the same profile as folded stacks for flame graphs");
+KNOB<string> KnobFoldedValue(KNOB_MODE_WRITEONCE, "pintool",
+    "folded_value","misses", "value of the folded stacks: accesses, misses, writebacks or stall");
+KNOB<BOOL>   KnobProfileStacks(KNOB_MODE_WRITEONCE, "pintool",
+    "profile_stacks","1", "key -pprof and -folded by calling context as well as by instruction");
 
 /* ===================================================================== */
 /* Print Help Message                                                    */
@@ -68,6 +195,9 @@ INT32 Usage()
 /* Global Variables */
 /* ===================================================================== */
 
+// upper bound for per-thread state indexed by THREADID
+const UINT32 MAX_THREADS = 256;
+
 // wrap configuation constants into their own name space to avoid name clashes
 namespace DL1
 {
@@ -96,252 +226,1916 @@ typedef  COUNTER_ARRAY<UINT64, COUNTER_NUM> COUNTER_HIT_MISS;
 // conceptually this is an array indexed by instruction address
 COMPRESSOR_COUNTER<ADDRINT, UINT32, COUNTER_HIT_MISS> profile;
 
+// reverse of profile.Map(): instruction address of each instId
+std::vector<ADDRINT> instAddr;
+
+// image-relative row key of each instId, only filled with -follow: processes
+// load their images at different addresses, so dcache_merge cannot sum
+// rows by raw address
+std::vector<string> instKeys;
+
+// per-instruction stride table, only allocated with -pattern
+ACCESS_PATTERN_TABLE* patterns = NULL;
+
 /* ===================================================================== */
 
-VOID LoadMulti(ADDRINT addr, UINT32 size, UINT32 instId)
+/// "<image path>+<offset>", whitespace in the path replaced so the key stays one token
+static string ImageKey(ADDRINT iaddr)
 {
-    // first level D-cache
-    const BOOL dl1Hit = dl1->Access(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD);
+    const IMG img = IMG_FindByAddress(iaddr);
+    if( ! IMG_Valid(img) ) return "?+" + StringFromAddrint(iaddr);
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+    string name = IMG_Name(img);
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if (name[i] == ' ' || name[i] == '\t') name[i] = '_';
+    }
+    return name + "+" + StringFromAddrint(iaddr - IMG_LowAddress(img));
+}
+
+static UINT32 MapInstruction(ADDRINT iaddr, UINT32 size)
+{
+    const UINT32 instId = profile.Map(iaddr);
+
+    if (instId >= instAddr.size()) instAddr.resize(instId + 1);
+    instAddr[instId] = iaddr;
+    dl1->RegisterInstruction(instId);
+    if (KnobFollow && instId >= instKeys.size()) instKeys.push_back(ImageKey(iaddr));
+
+    if (patterns) patterns->Register(instId, size);
+
+    return instId;
 }
 
 /* ===================================================================== */
 
-VOID StoreMulti(ADDRINT addr, UINT32 size, UINT32 instId)
-{
-    // first level D-cache
-    const BOOL dl1Hit = dl1->Access(addr, size, CACHE_BASE::ACCESS_TYPE_STORE);
+// live heap objects, only allocated when a model reports per allocation site
+ALLOC_SITES* allocSites = NULL;
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+// page placement behind the cache, only allocated with -numa
+NUMA_MODEL* numa = NULL;
+
+// what-if layout rules, only allocated with -remap
+ADDR_REMAP* remap = NULL;
+
+/*!
+ *  Address the simulated memory system sees for an application address;
+ *  everything keyed by application objects keeps the original address
+ */
+static inline ADDRINT Simulated(ADDRINT addr, THREADID tid)
+{
+    return remap ? remap->Map(addr, tid) : addr;
 }
 
 /* ===================================================================== */
 
-VOID LoadSingle(ADDRINT addr, UINT32 instId)
+// per-thread state between entry and exit of an allocation routine
+struct ALLOC_CALL
 {
-    // @todo we may access several cache lines for 
-    // first level D-cache
-    const BOOL dl1Hit = dl1->AccessSingleLine(addr, CACHE_BASE::ACCESS_TYPE_LOAD);
+    ADDRINT size;
+    ADDRINT site;
+    ADDRINT oldPtr;
+    UINT32 depth;
+};
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+ALLOC_CALL allocCalls[MAX_THREADS];
+
+static VOID AllocBefore(THREADID tid, ADDRINT size, ADDRINT oldPtr, ADDRINT returnIp)
+{
+    if (tid >= MAX_THREADS) return;
+
+    // allocators calling each other internally count once
+    ALLOC_CALL & call = allocCalls[tid];
+    if (call.depth++ > 0) return;
+
+    call.size = size;
+    call.site = returnIp;
+    call.oldPtr = oldPtr;
 }
-/* ===================================================================== */
 
-VOID StoreSingle(ADDRINT addr, UINT32 instId)
+VOID MallocBefore(THREADID tid, ADDRINT size, ADDRINT returnIp)
 {
-    // @todo we may access several cache lines for 
-    // first level D-cache
-    const BOOL dl1Hit = dl1->AccessSingleLine(addr, CACHE_BASE::ACCESS_TYPE_STORE);
+    AllocBefore(tid, size, 0, returnIp);
+}
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+VOID CallocBefore(THREADID tid, ADDRINT count, ADDRINT size, ADDRINT returnIp)
+{
+    AllocBefore(tid, count * size, 0, returnIp);
 }
 
-/* ===================================================================== */
+VOID ReallocBefore(THREADID tid, ADDRINT oldPtr, ADDRINT size, ADDRINT returnIp)
+{
+    AllocBefore(tid, size, oldPtr, returnIp);
+}
+
+VOID AllocAfter(THREADID tid, ADDRINT ptr)
+{
+    if (tid >= MAX_THREADS) return;
+
+    ALLOC_CALL & call = allocCalls[tid];
+    if (call.depth == 0 || --call.depth > 0) return;
+
+    if (allocSites)
+    {
+        if (call.oldPtr != 0 && ptr != 0) allocSites->Free(call.oldPtr);
+        allocSites->Allocate(ptr, call.size, call.site);
+    }
+    if (remap)
+    {
+        if (call.oldPtr != 0 && ptr != 0) remap->Free(call.oldPtr);
+        remap->Allocate(ptr, call.size, call.site);
+    }
+}
 
-VOID LoadMultiFast(ADDRINT addr, UINT32 size)
+VOID FreeBefore(ADDRINT ptr)
 {
-    dl1->Access(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD);
+    if (allocSites) allocSites->Free(ptr);
+    if (remap) remap->Free(ptr);
 }
 
 /* ===================================================================== */
 
-VOID StoreMultiFast(ADDRINT addr, UINT32 size)
+// the reference each thread is looking up in dl1, before and after -remap;
+// only kept with -numa, whose miss hook sees just the simulated line
+struct NUMA_REFERENCE
+{
+    ADDRINT addr;
+    ADDRINT simAddr;
+};
+NUMA_REFERENCE numaReferences[MAX_THREADS];
+
+/*!
+ *  Allocation sites are keyed by application addresses, so the line that
+ *  missed is mapped back onto the reference that caused the miss
+ */
+VOID NumaMiss(ADDRINT lineAddr, CACHE_BASE::ACCESS_TYPE accessType, UINT32 instId, VOID * v)
 {
-    dl1->Access(addr, size, CACHE_BASE::ACCESS_TYPE_STORE);
+    const THREADID tid = PIN_ThreadId();
+    UINT32 site = ALLOC_SITES::NO_SITE;
+    if (allocSites && tid < MAX_THREADS)
+    {
+        const NUMA_REFERENCE & ref = numaReferences[tid];
+        const ADDRINT addr = lineAddr > ref.simAddr ? ref.addr + (lineAddr - ref.simAddr) : ref.addr;
+        site = allocSites->Site(addr, tid);
+    }
+    numa->Access(lineAddr, tid, instId, site);
 }
 
-/* ===================================================================== */
+// near/far memory behind the cache, only allocated with -tier_near
+MEM_TIERS* tiers = NULL;
 
-VOID LoadSingleFast(ADDRINT addr)
+VOID TierMiss(ADDRINT lineAddr, CACHE_BASE::ACCESS_TYPE accessType, UINT32 instId, VOID * v)
 {
-    dl1->AccessSingleLine(addr, CACHE_BASE::ACCESS_TYPE_LOAD);    
+    tiers->Access(lineAddr, PIN_ThreadId());
 }
 
-/* ===================================================================== */
+// most frequently missing lines and pages, only allocated with -hot
+HEAVY_HITTERS* hotLines = NULL;
+HEAVY_HITTERS* hotPages = NULL;
+ADDRINT pageMask = 0;
 
-VOID StoreSingleFast(ADDRINT addr)
+VOID HotMiss(ADDRINT lineAddr, CACHE_BASE::ACCESS_TYPE accessType, UINT32 instId, VOID * v)
 {
-    dl1->AccessSingleLine(addr, CACHE_BASE::ACCESS_TYPE_STORE);    
+    hotLines->Add(lineAddr, instId);
+    hotPages->Add(lineAddr & pageMask, instId);
 }
 
+// distinct lines/pages per interval, only allocated with -ws
+WORKING_SET* workingSet = NULL;
+
+// reuse distances at several line sizes, only allocated with -mrc; its
+// stacks are shared by all threads
+MRC_SWEEP* missRatioCurves = NULL;
+PIN_LOCK missRatioCurvesLock;
 
+// thread x thread transfers, only allocated with -share
+SHARING_MATRIX* sharing = NULL;
+
+// per allocation site offset histograms, only allocated with -fields
+FIELD_HEAT* fieldHeat = NULL;
 
 /* ===================================================================== */
 
-VOID Instruction(INS ins, void * v)
+// per-thread store buffers and write-combining buffers, only allocated with
+// -sb / -wcb; each thread fills and drains its own, threads beyond
+// MAX_THREADS store straight into dl1
+std::vector<STORE_BUFFER*> storeBuffers;
+std::vector<WRITE_COMBINING_BUFFER*> wcBuffers;
+
+static inline STORE_BUFFER * StoreBuffer(THREADID tid)
 {
-    if (INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
-    {
-        // map sparse INS addresses to dense IDs
-        const ADDRINT iaddr = INS_Address(ins);
-        const UINT32 instId = profile.Map(iaddr);
+    return tid < storeBuffers.size() ? storeBuffers[tid] : NULL;
+}
 
-        const UINT32 size = INS_MemoryReadSize(ins);
-        const BOOL   single = (size <= 4);
-                
-        if( KnobTrackLoads )
-        {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR) LoadSingle,
-                    IARG_MEMORYREAD_EA,
-                    IARG_UINT32, instId,
-                    IARG_END);
-            }
-            else
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE,  (AFUNPTR) LoadMulti,
-                    IARG_MEMORYREAD_EA,
-                    IARG_MEMORYREAD_SIZE,
-                    IARG_UINT32, instId,
-                    IARG_END);
-            }
-                
-        }
-        else
-        {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE,  (AFUNPTR) LoadSingleFast,
-                    IARG_MEMORYREAD_EA,
-                    IARG_END);
-                        
-            }
-            else
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE,  (AFUNPTR) LoadMultiFast,
-                    IARG_MEMORYREAD_EA,
-                    IARG_MEMORYREAD_SIZE,
-                    IARG_END);
-            }
-        }
+static inline WRITE_COMBINING_BUFFER * WcBuffer(THREADID tid)
+{
+    return tid < wcBuffers.size() ? wcBuffers[tid] : NULL;
+}
+
+// perfect-cache oracle and its baseline shadow cache, only allocated with -oracle
+CACHE_ORACLE* oracle = NULL;
+DL1::CACHE* baseline = NULL;
+
+static inline BOOL Lookup(DL1::CACHE * cache, ADDRINT addr, UINT32 size, CACHE_BASE::ACCESS_TYPE accessType,
+                          UINT32 instId, BOOL single)
+{
+    return single ? cache->AccessSingleLine(addr, accessType, size, instId)
+                  : cache->Access(addr, size, accessType, instId);
+}
+
+// sampled shadow tag directories next to dl1, only allocated with -atd
+std::vector<AUX_TAG_DIRECTORY*> shadows;
+
+// per-thread stack distance monitors at dl1, only allocated with -umon
+UTILITY_MONITOR* umon = NULL;
+
+/*!
+ *  Access dl1 and hand the same line stream to the shadow directories and
+ *  utility monitors
+ */
+static inline BOOL Dl1Lookup(ADDRINT addr, UINT32 size, CACHE_BASE::ACCESS_TYPE accessType, UINT32 instId, BOOL single,
+                             THREADID tid)
+{
+    for (UINT32 i = 0; i < shadows.size(); i++)
+    {
+        if (single) shadows[i]->AccessSingleLine(addr);
+        else shadows[i]->Access(addr, size);
     }
-        
-    if ( INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
+    if (umon) umon->Access(addr, size, tid);
+    return Lookup(dl1, addr, size, accessType, instId, single);
+}
+
+/*!
+ *  The dl1 access of every reference; perfect is set for instructions the
+ *  oracle selected at instrumentation time
+ */
+static inline BOOL CacheAccess(ADDRINT addr, UINT32 size, CACHE_BASE::ACCESS_TYPE accessType, UINT32 instId,
+                               BOOL single, THREADID tid, BOOL perfect = false)
+{
+    const ADDRINT simAddr = Simulated(addr, tid);
+    if (numa && tid < MAX_THREADS)
     {
-        // map sparse INS addresses to dense IDs
-        const ADDRINT iaddr = INS_Address(ins);
-        const UINT32 instId = profile.Map(iaddr);
-            
-        const UINT32 size = INS_MemoryWriteSize(ins);
+        numaReferences[tid].addr = addr;
+        numaReferences[tid].simAddr = simAddr;
+    }
+    if (! oracle) return Dl1Lookup(simAddr, size, accessType, instId, single, tid);
 
-        const BOOL   single = (size <= 4);
-                
-        if( KnobTrackStores )
-        {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreSingle,
-                    IARG_MEMORYWRITE_EA,
-                    IARG_UINT32, instId,
-                    IARG_END);
-            }
-            else
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreMulti,
-                    IARG_MEMORYWRITE_EA,
-                    IARG_MEMORYWRITE_SIZE,
-                    IARG_UINT32, instId,
-                    IARG_END);
-            }
-                
-        }
-        else
-        {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreSingleFast,
-                    IARG_MEMORYWRITE_EA,
-                    IARG_END);
-                        
-            }
-            else
-            {
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreMultiFast,
-                    IARG_MEMORYWRITE_EA,
-                    IARG_MEMORYWRITE_SIZE,
-                    IARG_END);
-            }
-        }
-            
+    const BOOL baselineHit = Lookup(baseline, simAddr, size, accessType, CACHE_BASE::NO_INST, single);
+
+    perfect = perfect || oracle->Selected(addr);
+    BOOL dl1Hit = true;
+    if (! perfect || oracle->Fill())
+    {
+        const BOOL hit = Dl1Lookup(simAddr, size, accessType, instId, single, tid);
+        if (! perfect) dl1Hit = hit;
     }
+
+    oracle->Count(perfect, baselineHit, dl1Hit);
+    return dl1Hit;
 }
 
-/* ===================================================================== */
+// counters published while the program runs, only allocated with -live
+LIVE_STATS* live = NULL;
 
-VOID Fini(int code, VOID * v)
+// what leaves dl1, only allocated with -miss_trace; times count dl1 references
+TRACE_RECORDER* missRecorder = NULL;
+UINT64 missTime = 0;
+
+// instIds of prefetch instructions, only filled with -miss_trace
+std::vector<bool> prefetchInst;
+
+static inline ADDRINT InstructionAddress(UINT32 instId)
 {
-    // print D-cache profile
-    // @todo what does this print
-    
-    outFile << "PIN:MEMLATENCIES 1.0. 0x0\n";
-            
-    outFile <<
-        "#\n"
-        "# DCACHE stats\n"
-        "#\n";
-    
-    outFile << dl1->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    return instId < instAddr.size() ? instAddr[instId] : 0;
+}
 
-    if( KnobTrackLoads || KnobTrackStores ) {
-        outFile <<
-            "#\n"
-            "# LOAD stats\n"
-            "#\n";
-        
-        outFile << profile.StringLong();
+VOID MissStreamMiss(ADDRINT lineAddr, CACHE_BASE::ACCESS_TYPE accessType, UINT32 instId, VOID * v)
+{
+    const bool prefetch = instId < prefetchInst.size() && prefetchInst[instId];
+    missRecorder->Record(PIN_ThreadId(), __atomic_load_n(&missTime, __ATOMIC_RELAXED),
+                         InstructionAddress(instId), lineAddr, dl1->LineSize(),
+                         accessType == CACHE_BASE::ACCESS_TYPE_STORE, prefetch ? TRACE_PREFETCH : TRACE_DEMAND);
+}
+
+VOID MissStreamWriteback(ADDRINT lineAddr, UINT32 instId, VOID * v)
+{
+    missRecorder->Record(PIN_ThreadId(), __atomic_load_n(&missTime, __ATOMIC_RELAXED),
+                         InstructionAddress(instId), lineAddr, dl1->LineSize(), true, TRACE_WRITEBACK);
+}
+
+// per instruction and calling context profile, only allocated with -pprof
+// or -folded; it counts per thread and locks only to add calling contexts
+MISS_PROFILE* missProfile = NULL;
+
+VOID ProfileWriteback(ADDRINT lineAddr, UINT32 instId, VOID * v)
+{
+    if (instId == CACHE_BASE::NO_INST) return;
+
+    missProfile->Writeback(PIN_ThreadId(), instId);
+}
+
+VOID ProfileCall(THREADID tid, ADDRINT callSite, ADDRINT returnAddr)
+{
+    missProfile->Contexts()->Call(tid, callSite, returnAddr);
+}
+
+VOID ProfileReturn(THREADID tid, ADDRINT target)
+{
+    missProfile->Contexts()->Return(tid, target);
+}
+
+/*!
+ *  Hooks that need the dl1 outcome of a reference; instId is
+ *  CACHE_BASE::NO_INST for untracked references
+ */
+static inline VOID Accessed(ADDRINT addr, UINT32 size, CACHE_BASE::ACCESS_TYPE accessType, UINT32 instId, BOOL hit,
+                            THREADID tid)
+{
+    if (live) live->Count(tid, 0, accessType, hit);
+    if (missRecorder) __atomic_fetch_add(&missTime, 1, __ATOMIC_RELAXED);
+
+    if (missProfile && instId != CACHE_BASE::NO_INST) missProfile->Access(tid, instId, hit);
+
+    if (fieldHeat)
+    {
+        ALLOC_SITES::OBJECT object;
+        if (allocSites->Find(addr, object, tid)) fieldHeat->Access(object.site, addr - object.start, hit, tid);
     }
-    outFile.close();
 }
 
-/* ===================================================================== */
-/* Main                                                                  */
-/* ===================================================================== */
+/*!
+ *  Write a store leaving the store buffer of thread tid into dl1
+ */
+static VOID CommitStore(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, false, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, dl1Hit, tid);
 
-int main(int argc, char *argv[])
+    if (instId == CACHE_BASE::NO_INST) return;
+    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
+    profile[instId][counter]++;
+}
+
+static VOID DrainOldestStore(STORE_BUFFER * buffer, THREADID tid)
 {
-    PIN_InitSymbols();
+    const STORE_BUFFER::ENTRY & oldest = buffer->Oldest();
+    CommitStore(oldest.addr, oldest.size, oldest.instId, tid);
+    buffer->Pop();
+}
 
-    if( PIN_Init(argc,argv) )
+static VOID DrainStores(THREADID tid)
+{
+    STORE_BUFFER * buffer = StoreBuffer(tid);
+    if (buffer)
     {
-        return Usage();
+        while (! buffer->Empty()) DrainOldestStore(buffer, tid);
     }
+    if (WcBuffer(tid)) WcBuffer(tid)->FlushAll();
+}
 
-    outFile.open(KnobOutputFile.Value().c_str());
+/*!
+ *  Stores merged into a buffered store never access dl1 on their own and
+ *  are therefore not counted in the per-instruction profile
+ *  @return false if the thread has no store buffer, the store then goes to dl1
+ */
+static BOOL BufferStore(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    STORE_BUFFER * buffer = StoreBuffer(tid);
+    if (! buffer) return false;
 
-    dl1 = new DL1::CACHE("L1 Data Cache", 
-                         KnobCacheSize.Value() * KILO,
-                         KnobLineSize.Value(),
-                         KnobAssociativity.Value(),
-                         2048*1024,
-                         64,
-                         16);
-    
-    profile.SetKeyName("iaddr          ");
-    profile.SetCounterName("dcache:miss        dcache:hit");
+    if (buffer->Tick()) DrainOldestStore(buffer, tid);
 
-    COUNTER_HIT_MISS threshold;
+    if (buffer->Merge(addr, size)) return true;
 
-    threshold[COUNTER_HIT] = KnobThresholdHit.Value();
-    threshold[COUNTER_MISS] = KnobThresholdMiss.Value();
-    
-    profile.SetThreshold( threshold );
-    
-    INS_AddInstrumentFunction(Instruction, 0);
-    PIN_AddFiniFunction(Fini, 0);
+    if (buffer->Full())
+    {
+        buffer->Stall();
+        DrainOldestStore(buffer, tid);
+    }
+    buffer->Insert(addr, size, instId);
+    return true;
+}
+
+/*!
+ *  Hooks that see every reference as issued by the application, before any
+ *  buffering and independent of the cache outcome
+ */
+static inline VOID Reference(ADDRINT addr, UINT32 size, CACHE_BASE::ACCESS_TYPE accessType, THREADID tid)
+{
+    if (workingSet) workingSet->Access(addr, size, tid);
+    if (missRatioCurves)
+    {
+        PIN_GetLock(&missRatioCurvesLock, tid + 1);
+        missRatioCurves->Access(addr, size);
+        PIN_ReleaseLock(&missRatioCurvesLock);
+    }
+
+    if (sharing)
+    {
+        const bool isWrite = (accessType == CACHE_BASE::ACCESS_TYPE_STORE);
+        const UINT32 producer = sharing->Access(addr, isWrite, tid);
+        if (producer != SHARING_MATRIX::NO_SHARER)
+        {
+            const UINT32 site = allocSites->Site(addr, tid);
+            if (site != ALLOC_SITES::NO_SITE) sharing->CountSite(tid, site);
+        }
+    }
+}
+
+/// A load sees only the buffered stores of its own thread
+static inline VOID BeforeLoad(ADDRINT addr, UINT32 size, THREADID tid)
+{
+    STORE_BUFFER * buffer = StoreBuffer(tid);
+    if (buffer)
+    {
+        if (buffer->Tick()) DrainOldestStore(buffer, tid);
+        buffer->Lookup(addr, size);
+    }
+    WRITE_COMBINING_BUFFER * wc = WcBuffer(tid);
+    if (wc) wc->Load(addr, size);
+}
+
+/* ===================================================================== */
+
+VOID LoadMulti(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, tid);
+    BeforeLoad(addr, size, tid);
+
+    // first level D-cache
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, instId, false, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, instId, dl1Hit, tid);
+
+    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
+    profile[instId][counter]++;
+
+    if (patterns) patterns->Record(instId, addr, true);
+}
+
+/* ===================================================================== */
+
+VOID StoreMulti(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, tid);
+    if (patterns) patterns->Record(instId, addr, false);
+
+    if (BufferStore(addr, size, instId, tid)) return;
+
+    // first level D-cache
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, false, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, dl1Hit, tid);
+
+    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
+    profile[instId][counter]++;
+}
+
+/* ===================================================================== */
+
+VOID LoadSingle(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, tid);
+    BeforeLoad(addr, size, tid);
+
+    // @todo we may access several cache lines for 
+    // first level D-cache
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, instId, true, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, instId, dl1Hit, tid);
+
+    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
+    profile[instId][counter]++;
+
+    if (patterns) patterns->Record(instId, addr, true);
+}
+/* ===================================================================== */
+
+VOID StoreSingle(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, tid);
+    if (patterns) patterns->Record(instId, addr, false);
+
+    if (BufferStore(addr, size, instId, tid)) return;
+
+    // @todo we may access several cache lines for 
+    // first level D-cache
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, true, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, dl1Hit, tid);
+
+    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
+    profile[instId][counter]++;
+}
+
+/* ===================================================================== */
+
+VOID LoadMultiFast(ADDRINT addr, UINT32 size, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, tid);
+    BeforeLoad(addr, size, tid);
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, CACHE_BASE::NO_INST, false, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, CACHE_BASE::NO_INST, dl1Hit, tid);
+}
+
+/* ===================================================================== */
+
+VOID StoreMultiFast(ADDRINT addr, UINT32 size, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, tid);
+    if (BufferStore(addr, size, CACHE_BASE::NO_INST, tid)) return;
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, CACHE_BASE::NO_INST, false, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, CACHE_BASE::NO_INST, dl1Hit, tid);
+}
+
+/* ===================================================================== */
+
+VOID LoadSingleFast(ADDRINT addr, UINT32 size, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, tid);
+    BeforeLoad(addr, size, tid);
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, CACHE_BASE::NO_INST, true, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, CACHE_BASE::NO_INST, dl1Hit, tid);
+}
+
+/* ===================================================================== */
+
+VOID StoreSingleFast(ADDRINT addr, UINT32 size, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, tid);
+    if (BufferStore(addr, size, CACHE_BASE::NO_INST, tid)) return;
+    const BOOL dl1Hit = CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, CACHE_BASE::NO_INST, true, tid);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, CACHE_BASE::NO_INST, dl1Hit, tid);
+}
+
+/* ===================================================================== */
+
+/*!
+ *  References of instructions the oracle made perfect; their stores skip
+ *  the store buffer
+ */
+VOID LoadOracle(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, tid);
+    BeforeLoad(addr, size, tid);
+    CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, instId, false, tid, true);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_LOAD, instId, true, tid);
+    profile[instId][COUNTER_HIT]++;
+
+    if (patterns) patterns->Record(instId, addr, true);
+}
+
+VOID StoreOracle(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, tid);
+    if (patterns) patterns->Record(instId, addr, false);
+
+    CacheAccess(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, false, tid, true);
+    Accessed(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, instId, true, tid);
+    profile[instId][COUNTER_HIT]++;
+}
+
+/* ===================================================================== */
+
+/*!
+ *  Non-temporal stores bypass dl1 through the write-combining buffer and
+ *  drop a cached copy of their lines; threads beyond MAX_THREADS have no
+ *  buffer and their non-temporal stores are only counted as references
+ */
+VOID StoreNonTemporal(ADDRINT addr, UINT32 size, UINT32 instId, THREADID tid)
+{
+    Reference(addr, size, CACHE_BASE::ACCESS_TYPE_STORE, tid);
+    WRITE_COMBINING_BUFFER * wc = WcBuffer(tid);
+    if (wc == NULL) return;
+
+    const ADDRINT lineSize = dl1->LineSize();
+    const ADDRINT last = (addr + (size ? size - 1 : 0)) & ~(lineSize - 1);
+    for (ADDRINT line = addr & ~(lineSize - 1); line <= last; line += lineSize)
+    {
+        if (dl1->Invalidate(line, instId)) wc->CountInvalidation();
+    }
+    wc->Store(addr, size, instId);
+}
+
+/// A line leaving a write-combining buffer is written to memory around dl1
+VOID WcFlush(ADDRINT lineAddr, UINT32 instId, VOID * v)
+{
+    dl1->WriteAround(lineAddr, instId);
+}
+
+
+
+/* ===================================================================== */
+
+// reference trace, only allocated with -trace
+TRACE_RECORDER* traceRecorder = NULL;
+UINT64 traceTime = 0;
+
+// shared-memory fan-out, only allocated with -ring; each thread collects a
+// batch and takes the lock only to publish it
+REF_RING* ring = NULL;
+std::vector<TRACE_REF> ringBatches[MAX_THREADS];
+PIN_LOCK ringLock;
+UINT32 ringBatchRefs = 0;
+
+/// May wait for the slowest consumer while holding the lock
+static VOID PublishBatch(THREADID tid)
+{
+    std::vector<TRACE_REF> & batch = ringBatches[tid];
+    if (batch.empty()) return;
+
+    PIN_GetLock(&ringLock, tid + 1);
+    ring->Publish(&batch[0], batch.size());
+    PIN_ReleaseLock(&ringLock);
+    batch.clear();
+}
+
+// workload cloning profile, only allocated with -clone; its tables are
+// shared by all threads
+CLONE_PROFILE* cloneProfile = NULL;
+PIN_LOCK cloneLock;
+
+VOID RecordReference(ADDRINT pc, ADDRINT addr, UINT32 size, BOOL store, THREADID tid)
+{
+    const UINT64 time = __atomic_fetch_add(&traceTime, 1, __ATOMIC_RELAXED);
+    if (traceRecorder) traceRecorder->Record(tid, time, pc, addr, size, store);
+
+    if (cloneProfile)
+    {
+        PIN_GetLock(&cloneLock, tid + 1);
+        cloneProfile->Access(pc, addr, size, store);
+        PIN_ReleaseLock(&cloneLock);
+    }
+
+    if (ring && tid < MAX_THREADS)
+    {
+        const TRACE_REF ref = { time, pc, addr, size, tid, store != 0, TRACE_DEMAND };
+        ringBatches[tid].push_back(ref);
+        if (ringBatches[tid].size() >= ringBatchRefs) PublishBatch(tid);
+    }
+}
+
+/* ===================================================================== */
+
+// instructions executed so far, only counted with -stop_icount; threads
+// race on the count, so the stop point is approximate with threads
+UINT64 executedIns = 0;
+UINT64 stopInstructions = 0;
+volatile BOOL stopRequested = false;
+
+/*!
+ *  A stop trigger fired: the program continues natively.  The report is
+ *  written by the detach callback once no analysis routine runs.
+ */
+VOID StopAndDetach()
+{
+    if (__atomic_exchange_n(&stopRequested, true, __ATOMIC_RELAXED)) return;
+    PIN_Detach();
+}
+
+ADDRINT CountInstructions(UINT32 numIns)
+{
+    executedIns += numIns;
+    return executedIns >= stopInstructions;
+}
+
+/// xchg bx,bx: a no-op the program can place at the end of its region of interest
+static BOOL StopMarker(INS ins)
+{
+    return INS_Opcode(ins) == XED_ICLASS_XCHG && INS_OperandCount(ins) >= 2 &&
+           INS_OperandIsReg(ins, 0) && INS_OperandReg(ins, 0) == REG_BX &&
+           INS_OperandIsReg(ins, 1) && INS_OperandReg(ins, 1) == REG_BX;
+}
+
+VOID Trace(TRACE trace, VOID * v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) CountInstructions,
+                         IARG_UINT32, BBL_NumIns(bbl),
+                         IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) StopAndDetach, IARG_END);
+    }
+}
+
+VOID StopImageLoad(IMG img, VOID * v)
+{
+    RTN rtn = RTN_FindByName(img, KnobStopRoutine.Value().c_str());
+    if (! RTN_Valid(rtn)) return;
+
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) StopAndDetach, IARG_END);
+    RTN_Close(rtn);
+}
+
+/* ===================================================================== */
+
+static BOOL OracleInstruction(INS ins)
+{
+    if (! oracle || ! oracle->SelectsInstructions()) return false;
+
+    RTN rtn = INS_Rtn(ins);
+    return oracle->Selected(INS_Address(ins), RTN_Valid(rtn) ? RTN_Name(rtn) : "");
+}
+
+VOID Instruction(INS ins, void * v)
+{
+    const BOOL perfect = OracleInstruction(ins);
+
+    if (KnobStopMarker && StopMarker(ins))
+    {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) StopAndDetach, IARG_END);
+    }
+
+    // calling contexts of the miss profile
+    if (missProfile && missProfile->Contexts())
+    {
+        if (INS_IsCall(ins))
+        {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) ProfileCall,
+                           IARG_THREAD_ID,
+                           IARG_INST_PTR,
+                           IARG_ADDRINT, INS_NextAddress(ins),
+                           IARG_END);
+        }
+        else if (INS_IsRet(ins))
+        {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) ProfileReturn,
+                           IARG_THREAD_ID,
+                           IARG_BRANCH_TARGET_ADDR,
+                           IARG_END);
+        }
+    }
+
+    // the trace sees the application's references, before any model
+    if ((traceRecorder || ring || cloneProfile) && INS_IsStandardMemop(ins))
+    {
+        if (INS_IsMemoryRead(ins))
+        {
+            INS_InsertPredicatedCall(
+                ins, IPOINT_BEFORE, (AFUNPTR) RecordReference,
+                IARG_INST_PTR,
+                IARG_MEMORYREAD_EA,
+                IARG_MEMORYREAD_SIZE,
+                IARG_BOOL, false,
+                IARG_THREAD_ID,
+                IARG_END);
+        }
+        if (INS_IsMemoryWrite(ins))
+        {
+            INS_InsertPredicatedCall(
+                ins, IPOINT_BEFORE, (AFUNPTR) RecordReference,
+                IARG_INST_PTR,
+                IARG_MEMORYWRITE_EA,
+                IARG_MEMORYWRITE_SIZE,
+                IARG_BOOL, true,
+                IARG_THREAD_ID,
+                IARG_END);
+        }
+    }
+
+    if (INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
+    {
+        // map sparse INS addresses to dense IDs
+        const ADDRINT iaddr = INS_Address(ins);
+        const UINT32 size = INS_MemoryReadSize(ins);
+        const UINT32 instId = MapInstruction(iaddr, size);
+
+        const BOOL   single = (size <= 4);
+
+        if( missRecorder && INS_IsPrefetch(ins) ) {
+            if (instId >= prefetchInst.size()) prefetchInst.resize(instId + 1);
+            prefetchInst[instId] = true;
+        }
+                
+        if( perfect )
+        {
+            INS_InsertPredicatedCall(
+                ins, IPOINT_BEFORE, (AFUNPTR) LoadOracle,
+                IARG_MEMORYREAD_EA,
+                IARG_MEMORYREAD_SIZE,
+                IARG_UINT32, instId,
+                IARG_THREAD_ID,
+                IARG_END);
+        }
+        else if( KnobTrackLoads || missRecorder || missProfile || hotLines )
+        {
+            if( single )
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE, (AFUNPTR) LoadSingle,
+                    IARG_MEMORYREAD_EA,
+                    IARG_UINT32, size,
+                    IARG_UINT32, instId,
+                    IARG_THREAD_ID,
+                    IARG_END);
+            }
+            else
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) LoadMulti,
+                    IARG_MEMORYREAD_EA,
+                    IARG_MEMORYREAD_SIZE,
+                    IARG_UINT32, instId,
+                    IARG_THREAD_ID,
+                    IARG_END);
+            }
+                
+        }
+        else
+        {
+            if( single )
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) LoadSingleFast,
+                    IARG_MEMORYREAD_EA,
+                    IARG_UINT32, size,
+                    IARG_THREAD_ID,
+                    IARG_END);
+                        
+            }
+            else
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) LoadMultiFast,
+                    IARG_MEMORYREAD_EA,
+                    IARG_MEMORYREAD_SIZE,
+                    IARG_THREAD_ID,
+                    IARG_END);
+            }
+        }
+    }
+        
+    if ( INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
+    {
+        // map sparse INS addresses to dense IDs
+        const ADDRINT iaddr = INS_Address(ins);
+        const UINT32 size = INS_MemoryWriteSize(ins);
+        const UINT32 instId = MapInstruction(iaddr, size);
+
+        const BOOL   single = (size <= 4);
+
+        const string mnemonic = INS_Mnemonic(ins);
+        const BOOL   nonTemporal = mnemonic.find("MOVNT") != string::npos
+                                || mnemonic.find("MASKMOV") != string::npos;
+
+        if( ! wcBuffers.empty() && nonTemporal )
+        {
+            INS_InsertPredicatedCall(
+                ins, IPOINT_BEFORE,  (AFUNPTR) StoreNonTemporal,
+                IARG_MEMORYWRITE_EA,
+                IARG_MEMORYWRITE_SIZE,
+                IARG_UINT32, instId,
+                IARG_THREAD_ID,
+                IARG_END);
+        }
+        else if( perfect )
+        {
+            INS_InsertPredicatedCall(
+                ins, IPOINT_BEFORE,  (AFUNPTR) StoreOracle,
+                IARG_MEMORYWRITE_EA,
+                IARG_MEMORYWRITE_SIZE,
+                IARG_UINT32, instId,
+                IARG_THREAD_ID,
+                IARG_END);
+        }
+        else if( KnobTrackStores || missRecorder || missProfile || hotLines )
+        {
+            if( single )
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreSingle,
+                    IARG_MEMORYWRITE_EA,
+                    IARG_UINT32, size,
+                    IARG_UINT32, instId,
+                    IARG_THREAD_ID,
+                    IARG_END);
+            }
+            else
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreMulti,
+                    IARG_MEMORYWRITE_EA,
+                    IARG_MEMORYWRITE_SIZE,
+                    IARG_UINT32, instId,
+                    IARG_THREAD_ID,
+                    IARG_END);
+            }
+                
+        }
+        else
+        {
+            if( single )
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreSingleFast,
+                    IARG_MEMORYWRITE_EA,
+                    IARG_UINT32, size,
+                    IARG_THREAD_ID,
+                    IARG_END);
+                        
+            }
+            else
+            {
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) StoreMultiFast,
+                    IARG_MEMORYWRITE_EA,
+                    IARG_MEMORYWRITE_SIZE,
+                    IARG_THREAD_ID,
+                    IARG_END);
+            }
+        }
+            
+    }
+}
+
+/* ===================================================================== */
+
+static VOID InstrumentAlloc(IMG img, const char * name, AFUNPTR before, UINT32 args)
+{
+    RTN rtn = RTN_FindByName(img, name);
+    if (! RTN_Valid(rtn)) return;
+
+    RTN_Open(rtn);
+    if (args == 1)
+    {
+        RTN_InsertCall(rtn, IPOINT_BEFORE, before,
+                       IARG_THREAD_ID,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_RETURN_IP,
+                       IARG_END);
+    }
+    else
+    {
+        RTN_InsertCall(rtn, IPOINT_BEFORE, before,
+                       IARG_THREAD_ID,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                       IARG_RETURN_IP,
+                       IARG_END);
+    }
+    RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR) AllocAfter,
+                   IARG_THREAD_ID,
+                   IARG_FUNCRET_EXITPOINT_VALUE,
+                   IARG_END);
+    RTN_Close(rtn);
+}
+
+VOID ImageLoad(IMG img, VOID * v)
+{
+    InstrumentAlloc(img, "malloc", (AFUNPTR) MallocBefore, 1);
+    InstrumentAlloc(img, "calloc", (AFUNPTR) CallocBefore, 2);
+    InstrumentAlloc(img, "realloc", (AFUNPTR) ReallocBefore, 2);
+
+    RTN freeRtn = RTN_FindByName(img, "free");
+    if (RTN_Valid(freeRtn))
+    {
+        RTN_Open(freeRtn);
+        RTN_InsertCall(freeRtn, IPOINT_BEFORE, (AFUNPTR) FreeBefore,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_END);
+        RTN_Close(freeRtn);
+    }
+}
+
+/* ===================================================================== */
+
+static string HotTable(const HEAVY_HITTERS & hitters, const string & keyName)
+{
+    const std::vector<HEAVY_HITTERS::ENTRY> top = hitters.Top();
+
+    string out = "# " + ljstr(keyName, 17) + "      misses     max-error  dominant-iaddr\n";
+    for (UINT32 i = 0; i < top.size(); i++)
+    {
+        const HEAVY_HITTERS::ENTRY & e = top[i];
+        const string inst = e.inst < instAddr.size() ? StringFromAddrint(instAddr[e.inst]) : "-";
+        out += ljstr(StringFromAddrint(e.key), 19) + mydecstr(e.count, 12) + "  " +
+               mydecstr(e.error, 12) + "  " + inst + "\n";
+    }
+    return out;
+}
+
+static string SiteName(UINT32 site)
+{
+    const ADDRINT addr = allocSites->SiteAddress(site);
+
+    PIN_LockClient();
+    const string name = RTN_FindNameByAddress(addr);
+    PIN_UnlockClient();
+
+    return ljstr(StringFromAddrint(addr), 19) + (name.empty() ? "?" : name);
+}
+
+/* ===================================================================== */
+
+/* ===================================================================== */
+
+static string TraceFileName(const string & name)
+{
+    if( ! KnobFollow ) return name;
+    return name + "." + decstr(PIN_GetPid());
+}
+
+static BOOL StartTrace()
+{
+    traceRecorder = new TRACE_RECORDER(KnobTraceChunk.Value());
+    if( ! traceRecorder->Open(TraceFileName(KnobTrace.Value())) ) {
+        cerr << "cannot write trace " << TraceFileName(KnobTrace.Value()) << endl;
+        return false;
+    }
+    return true;
+}
+
+/*!
+ *  The miss stream records the geometry of the dl1 that filtered it, so
+ *  dcache_replay can tell which level it simulates
+ */
+static BOOL StartMissTrace()
+{
+    missRecorder = new TRACE_RECORDER(KnobTraceChunk.Value());
+    if( ! missRecorder->Open(TraceFileName(KnobMissTrace.Value()), KnobCacheSize.Value() * KILO,
+                             KnobLineSize.Value(), KnobAssociativity.Value()) ) {
+        cerr << "cannot write trace " << TraceFileName(KnobMissTrace.Value()) << endl;
+        return false;
+    }
+    return true;
+}
+
+static BOOL StartRing()
+{
+    ring = new REF_RING;
+    if( ! ring->Create(TraceFileName(KnobRing.Value()), KnobRingRefs.Value(), PIN_GetPid()) ) {
+        cerr << "cannot map ring " << TraceFileName(KnobRing.Value()) << endl;
+        return false;
+    }
+    ringBatchRefs = std::max(1U, UINT32(std::min(UINT64(KnobRingBatch.Value()), ring->Capacity())));
+    return true;
+}
+
+static VOID WriteCloneProfile()
+{
+    std::ofstream out(TraceFileName(KnobClone.Value()).c_str());
+    if( ! out ) {
+        cerr << "cannot write clone profile " << TraceFileName(KnobClone.Value()) << endl;
+        return;
+    }
+    cloneProfile->Write(out);
+}
+
+static VOID SymbolizeAddress(ADDRINT pc, string & function, string & file, INT32 & line)
+{
+    INT32 column = 0;
+    PIN_LockClient();
+    function = RTN_FindNameByAddress(pc);
+    PIN_GetSourceLocation(pc, &column, &line, &file);
+    PIN_UnlockClient();
+}
+
+static VOID WriteMissProfile()
+{
+    if( ! KnobPprof.Value().empty() ) {
+        std::ofstream out(TraceFileName(KnobPprof.Value()).c_str(), std::ios::binary);
+        if( out ) missProfile->WritePprof(out, instAddr, SymbolizeAddress);
+        else cerr << "cannot write pprof profile " << TraceFileName(KnobPprof.Value()) << endl;
+    }
+    if( ! KnobFolded.Value().empty() ) {
+        std::ofstream out(TraceFileName(KnobFolded.Value()).c_str());
+        if( out ) {
+            missProfile->WriteFolded(out, MISS_PROFILE_SAMPLE::TypeByName(KnobFoldedValue.Value()),
+                                     instAddr, SymbolizeAddress);
+        }
+        else cerr << "cannot write folded stacks " << TraceFileName(KnobFolded.Value()) << endl;
+    }
+}
+
+/// Partial batches go out at the end, then consumers see the end of the stream
+static VOID FinishRing()
+{
+    for (UINT32 tid = 0; tid < MAX_THREADS; tid++) PublishBatch(tid);
+    ring->Finish();
+}
+
+/* ===================================================================== */
+
+/// First column of the per-instruction rows
+static string InstructionKey(UINT32 instId)
+{
+    return instId < instKeys.size() ? instKeys[instId] : StringFromAddrint(instAddr[instId]);
+}
+
+/// -follow reports keep every row; dcache_merge thresholds the totals
+static UINT32 RowThreshold(UINT32 threshold)
+{
+    return KnobFollow ? 0 : threshold;
+}
+
+/*!
+ *  The report: everything Fini writes once the buffers are drained.  A
+ *  live snapshot writes it while the program runs.
+ */
+static VOID WriteStats(std::ostream & out)
+{
+    out << "PIN:MEMLATENCIES 1.0. 0x0\n";
+            
+    out <<
+        "#\n"
+        "# DCACHE stats\n"
+        "#\n";
+    
+    out << dl1->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+
+    if( dl1->SetSampling() ) {
+        out << dl1->StatsSetSampling("# ");
+    }
+
+    if( dl1->WriteValidate() ) {
+        out << dl1->StatsWriteValidate("# ");
+    }
+
+    if( ! shadows.empty() ) {
+        out << "# Shadow tag directories (about 1 in " << decstr(KnobShadowSets.Value()) << " sets):\n";
+        out << StatsAuxTagDirectories(shadows, "# ");
+    }
+
+    if( ! storeBuffers.empty() ) {
+        STORE_BUFFER total(KnobStoreBuffer.Value(), KnobLineSize.Value(), KnobStoreBufferDrain.Value());
+        for (UINT32 tid = 0; tid < storeBuffers.size(); tid++) total.AddStats(*storeBuffers[tid]);
+        out << total.StatsLong("# ");
+    }
+    if( ! wcBuffers.empty() ) {
+        WRITE_COMBINING_BUFFER total(KnobWriteCombining.Value(), KnobLineSize.Value());
+        for (UINT32 tid = 0; tid < wcBuffers.size(); tid++) total.AddStats(*wcBuffers[tid]);
+        out << total.StatsLong("# ");
+    }
+    if( numa ) out << numa->StatsLong("# ");
+    if( tiers ) out << tiers->StatsLong("# ");
+    if( remap ) out << remap->StatsLong("# ");
+    if( oracle ) out << oracle->StatsLong("# ", KnobHitLatency.Value(), KnobMissLatency.Value());
+
+    if( KnobTrackLoads || KnobTrackStores ) {
+        out <<
+            "#\n"
+            "# LOAD stats\n"
+            "#\n";
+        
+        if( ! KnobFollow ) out << profile.StringLong();
+        else {
+            out << "# iaddr              dcache:miss    dcache:hit\n";
+            for (UINT32 instId = 0; instId < instAddr.size(); instId++)
+            {
+                const UINT64 misses = profile[instId][COUNTER_MISS];
+                const UINT64 hits = profile[instId][COUNTER_HIT];
+                if (misses + hits == 0) continue;
+                out << ljstr(InstructionKey(instId), 19) << mydecstr(misses, 12) << "  " << mydecstr(hits, 12) << "\n";
+            }
+        }
+    }
+
+    if( patterns && (KnobTrackLoads || KnobTrackStores) ) {
+        out <<
+            "#\n"
+            "# ACCESS PATTERN stats\n"
+            "#\n"
+            "# iaddr              dcache:miss    dcache:hit  pattern        stride\n";
+
+        for (UINT32 instId = 0; instId < instAddr.size(); instId++)
+        {
+            const UINT64 misses = profile[instId][COUNTER_MISS];
+            const UINT64 hits = profile[instId][COUNTER_HIT];
+            if (misses < RowThreshold(KnobThresholdMiss.Value()) && hits < RowThreshold(KnobThresholdHit.Value())) continue;
+
+            const ACCESS_PATTERN::PATTERN pattern = patterns->Classify(instId);
+            out << ljstr(InstructionKey(instId), 19)
+                    << mydecstr(misses, 12) << "  " << mydecstr(hits, 12) << "  "
+                    << ljstr(ACCESS_PATTERN::PatternName(pattern), 12);
+            if (pattern == ACCESS_PATTERN::PATTERN_STRIDED)
+                out << "  " << decstr(patterns->Stride(instId));
+            out << "\n";
+        }
+    }
+
+    if( dl1->WriteValidate() && KnobTrackStores ) {
+        out <<
+            "#\n"
+            "# WRITE VALIDATE stats\n"
+            "#\n"
+            "# iaddr         store-miss-fills     avoidable  partial-read partial-evict\n";
+
+        for (UINT32 instId = 0; instId < instAddr.size(); instId++)
+        {
+            const CACHE_STATS fills = dl1->StoreMissFills(instId);
+            if (fills == 0 || fills < RowThreshold(KnobThresholdMiss.Value())) continue;
+
+            out << ljstr(InstructionKey(instId), 19)
+                    << mydecstr(fills, 12) << "  "
+                    << mydecstr(dl1->AvoidableFills(instId), 12) << "  "
+                    << mydecstr(dl1->PartialReadFills(instId), 12) << "  "
+                    << mydecstr(dl1->PartialEvictFills(instId), 12) << "\n";
+        }
+    }
+
+    if( numa ) {
+        out <<
+            "#\n"
+            "# NUMA stats by instruction\n"
+            "#\n"
+            "# iaddr              local-miss   remote-miss  remote-bytes\n";
+
+        for (UINT32 instId = 0; instId < instAddr.size(); instId++)
+        {
+            const UINT64 local = numa->InstCount(instId, NUMA::COUNTER_LOCAL);
+            const UINT64 remote = numa->InstCount(instId, NUMA::COUNTER_REMOTE);
+            if (local + remote == 0 || local + remote < RowThreshold(KnobThresholdMiss.Value())) continue;
+
+            out << ljstr(InstructionKey(instId), 19)
+                    << mydecstr(local, 12) << "  " << mydecstr(remote, 12) << "  "
+                    << mydecstr(numa->Bytes(remote), 12) << "\n";
+        }
+
+        out <<
+            "#\n"
+            "# NUMA stats by allocation site\n"
+            "#\n"
+            "#   local-miss   remote-miss  remote-bytes  site\n";
+
+        for (UINT32 site = 0; site < allocSites->NumSites(); site++)
+        {
+            const UINT64 local = numa->SiteCount(site, NUMA::COUNTER_LOCAL);
+            const UINT64 remote = numa->SiteCount(site, NUMA::COUNTER_REMOTE);
+            if (local + remote == 0 || local + remote < RowThreshold(KnobThresholdMiss.Value())) continue;
+
+            out << mydecstr(local, 14) << "  " << mydecstr(remote, 12) << "  "
+                    << mydecstr(numa->Bytes(remote), 12) << "  " << SiteName(site) << "\n";
+        }
+    }
+
+    if( workingSet ) {
+        out <<
+            "#\n"
+            "# WORKING SET (HyperLogLog estimates)\n"
+            "#\n";
+        out << workingSet->StatsLong("# ");
+    }
+
+    if( missRatioCurves ) {
+        out <<
+            "#\n"
+            "# MISS RATIO CURVES (fully associative LRU, misses per 100 references)\n"
+            "#\n";
+        out << missRatioCurves->StatsLong("# ", 1, KnobMissRatioCurvesMax.Value());
+    }
+
+    if( sharing ) {
+        out <<
+            "#\n"
+            "# SHARING stats\n"
+            "#\n";
+        out << sharing->StatsLong("# ");
+        out << "#    transfers  site\n";
+
+        for (UINT32 site = 0; site < allocSites->NumSites(); site++)
+        {
+            const UINT64 transfers = sharing->SiteTransfers(site);
+            if (transfers == 0 || transfers < RowThreshold(KnobThresholdMiss.Value())) continue;
+            out << mydecstr(transfers, 14) << "  " << SiteName(site) << "\n";
+        }
+    }
+
+    if( fieldHeat ) {
+        out <<
+            "#\n"
+            "# FIELD HEAT stats\n"
+            "#\n";
+
+        // largest object types first
+        std::vector<std::pair<ADDRINT, UINT32> > sites;
+        for (UINT32 site = 0; site < allocSites->NumSites(); site++)
+        {
+            if (fieldHeat->SiteAccesses(site) == 0) continue;
+            sites.push_back(std::make_pair(allocSites->SiteMaxSize(site), site));
+        }
+        std::sort(sites.rbegin(), sites.rend());
+
+        for (UINT32 i = 0; i < sites.size() && i < KnobFieldHeat.Value(); i++)
+        {
+            const UINT32 site = sites[i].second;
+            out << "# site " << SiteName(site)
+                    << "  objects " << decstr(allocSites->SiteAllocations(site))
+                    << "  max-size " << decstr(UINT64(allocSites->SiteMaxSize(site))) << "\n";
+            out << fieldHeat->StatsSite(site, "# ");
+        }
+    }
+
+    if( umon ) {
+        out <<
+            "#\n"
+            "# UTILITY MONITORS (lookahead way partition)\n"
+            "#\n";
+        out << umon->StatsLong("# ");
+    }
+
+    if( hotLines ) {
+        out <<
+            "#\n"
+            "# HOT MISSING LINES\n"
+            "#\n";
+        out << HotTable(*hotLines, "line");
+        out <<
+            "#\n"
+            "# HOT MISSING PAGES\n"
+            "#\n";
+        out << HotTable(*hotPages, "page");
+    }
+
+    if( ring ) {
+        out <<
+            "#\n"
+            "# REFERENCE RING\n"
+            "#\n";
+        out << ring->StatsLong("# ");
+    }
+}
+
+/*!
+ *  An exiting thread drains its own buffers, so its stores reach dl1 as
+ *  its own references
+ */
+VOID ThreadFini(THREADID tid, const CONTEXT * ctxt, INT32 code, VOID * v)
+{
+    DrainStores(tid);
+}
+
+VOID Fini(int code, VOID * v)
+{
+    // print D-cache profile
+    // @todo what does this print
+
+    // stores still in flight in threads that did not exit reach the cache
+    // before the stats are taken
+    for (UINT32 tid = 0; tid < MAX_THREADS; tid++) DrainStores(tid);
+    if( workingSet ) workingSet->Finish();
+    if( umon ) umon->Finish();
+    if( traceRecorder ) traceRecorder->Finish();
+    if( missRecorder ) missRecorder->Finish();
+    if( ring ) FinishRing();
+    if( cloneProfile ) WriteCloneProfile();
+    if( missProfile ) WriteMissProfile();
+
+    WriteStats(outFile);
+    outFile.close();
+
+    // final totals for whoever is watching
+    if( live ) live->Publish();
+}
+
+/*!
+ *  dl1, the oracle's baseline copy and the shadow tag directories: the
+ *  state a forked child can inherit warm
+ */
+static BOOL CreateCaches()
+{
+    dl1 = new DL1::CACHE("L1 Data Cache", 
+                         KnobCacheSize.Value() * KILO,
+                         KnobLineSize.Value(),
+                         KnobAssociativity.Value(),
+                         2048*1024,
+                         64,
+                         16);
+
+    if( KnobWriteValidate ) {
+        if( KnobLineSize.Value() > 64 ) {
+            cerr << "wv needs lines of at most 64 bytes" << endl;
+            return false;
+        }
+        dl1->EnableWriteValidate();
+    }
+    dl1->EnableSetSampling(KnobSampleSets.Value());
+
+    if( ! KnobOracle.Value().empty() ) {
+        // same geometry as dl1, fed the unmodified reference stream
+        baseline = new DL1::CACHE("Baseline Shadow Cache",
+                                  KnobCacheSize.Value() * KILO,
+                                  KnobLineSize.Value(),
+                                  KnobAssociativity.Value(),
+                                  2048*1024,
+                                  64,
+                                  16);
+        baseline->EnableSetSampling(KnobSampleSets.Value());
+    }
+
+    std::istringstream shadowPolicies(KnobShadowPolicies.Value());
+    string policyName;
+    while( std::getline(shadowPolicies, policyName, ',') ) {
+        const AUX_TAG_DIRECTORY::POLICY policy = AUX_TAG_DIRECTORY::PolicyByName(policyName);
+        if( policy == AUX_TAG_DIRECTORY::POLICY_NUM ) return false;
+        const UINT32 ways = KnobAssociativity.Value();
+        if( policy == AUX_TAG_DIRECTORY::POLICY_PLRU && ((ways & (ways - 1)) || ways > 32) ) {
+            cerr << "atd plru needs a power of two associativity of at most 32" << endl;
+            return false;
+        }
+
+        shadows.push_back(new AUX_TAG_DIRECTORY(policy,
+                                                KnobCacheSize.Value() * KILO,
+                                                KnobLineSize.Value(),
+                                                KnobAssociativity.Value(),
+                                                KnobShadowSets.Value()));
+    }
+    return true;
+}
+
+static VOID DeleteCaches()
+{
+    delete dl1;
+    delete baseline;
+    for (UINT32 i = 0; i < shadows.size(); i++) delete shadows[i];
+
+    dl1 = baseline = NULL;
+    shadows.clear();
+}
+
+/*!
+ *  Every model behind or beside the caches, set up from the knobs
+ */
+static BOOL CreateModels()
+{
+    if( ! KnobOracle.Value().empty() ) {
+        std::ifstream rules(KnobOracle.Value().c_str());
+        if( ! rules ) {
+            cerr << "cannot open oracle file " << KnobOracle.Value() << endl;
+            return false;
+        }
+        oracle = new CACHE_ORACLE(KnobOracleFill);
+        const UINT32 badLine = oracle->Read(rules);
+        if( badLine ) {
+            cerr << KnobOracle.Value() << ":" << badLine << ": bad oracle rule" << endl;
+            return false;
+        }
+    }
+
+    if( KnobNumaNodes.Value() > 0 ) {
+        const NUMA::POLICY policy = NUMA::PolicyByName(KnobNumaPolicy.Value());
+        if( policy == NUMA::POLICY_NUM ) return false;
+        if( KnobNumaNodes.Value() > 256 || KnobNumaBindNode.Value() >= KnobNumaNodes.Value() ) {
+            cerr << "numa nodes must be at most 256 and numa_bind below numa" << endl;
+            return false;
+        }
+
+        numa = new NUMA_MODEL(KnobNumaNodes.Value(), policy, KnobNumaBindNode.Value(),
+                              KnobPageSize.Value(), KnobLineSize.Value());
+
+        std::istringstream threadNodes(KnobNumaThreads.Value());
+        string node;
+        for (UINT32 tid = 0; std::getline(threadNodes, node, ','); tid++)
+        {
+            const INT32 threadNode = atoi(node.c_str());
+            if( threadNode < 0 || UINT32(threadNode) >= KnobNumaNodes.Value() ) {
+                cerr << "numa_threads: node " << node << " of thread " << tid << " out of range" << endl;
+                return false;
+            }
+            numa->SetThreadNode(tid, threadNode);
+        }
+    }
+
+    if( KnobTierNearPages.Value() > 0 ) {
+        TIER_POLICY * policy = NULL;
+        if( KnobTierPolicy.Value() == "static" ) policy = new TIER_POLICIES::STATIC;
+        else if( KnobTierPolicy.Value() == "on-demand" ) policy = new TIER_POLICIES::ON_DEMAND;
+        else if( KnobTierPolicy.Value() == "hotness" ) policy = new TIER_POLICIES::HOTNESS(KnobTierThreshold.Value());
+        else return false;
+
+        tiers = new MEM_TIERS(KnobTierNearPages.Value(), KnobPageSize.Value(), KnobTierEpoch.Value(), policy);
+    }
+
+    if( KnobHotLines.Value() > 0 ) {
+        const UINT32 width = KnobHotSketchWidth.Value();
+        if( width <= 1 || (width & (width - 1)) ) {
+            cerr << "hot_width must be a power of two above 1" << endl;
+            return false;
+        }
+        hotLines = new HEAVY_HITTERS(KnobHotLines.Value(), KnobHotSketchWidth.Value());
+        hotPages = new HEAVY_HITTERS(KnobHotLines.Value(), KnobHotSketchWidth.Value());
+        pageMask = ~ADDRINT(KnobPageSize.Value() - 1);
+    }
+
+    if( KnobWorkingSet.Value() > 0 ) {
+        if( KnobWorkingSetPrecision.Value() < 4 || KnobWorkingSetPrecision.Value() > 18 ) {
+            cerr << "ws_precision must be between 4 and 18" << endl;
+            return false;
+        }
+        workingSet = new WORKING_SET(KnobLineSize.Value(), KnobPageSize.Value(), KnobWorkingSet.Value(),
+                                     MAX_THREADS, KnobWorkingSetPrecision.Value());
+    }
+
+    if( ! KnobMissRatioCurves.Value().empty() ) {
+        std::istringstream list(KnobMissRatioCurves.Value());
+        std::vector<UINT32> lineSizes;
+        string lineSize;
+        while( std::getline(list, lineSize, ',') ) {
+            const UINT32 bytes = atoi(lineSize.c_str());
+            if( bytes == 0 || (bytes & (bytes - 1)) ) return false;
+            lineSizes.push_back(bytes);
+        }
+        if( lineSizes.empty() ) return false;
+        PIN_InitLock(&missRatioCurvesLock);
+        missRatioCurves = new MRC_SWEEP(lineSizes);
+    }
+
+    if( KnobSharing ) sharing = new SHARING_MATRIX(KnobLineSize.Value());
+
+    if( KnobFieldHeat.Value() > 0 ) {
+        fieldHeat = new FIELD_HEAT(KnobFieldGranularity.Value(), KnobFieldMaxOffset.Value(), MAX_THREADS);
+    }
+
+    if( KnobUtilityMonitor.Value() > 0 ) {
+        umon = new UTILITY_MONITOR(KnobCacheSize.Value() * KILO, KnobLineSize.Value(), KnobAssociativity.Value(),
+                                   KnobUtilityMonitorSets.Value(), MAX_THREADS, KnobUtilityMonitor.Value());
+    }
+
+    if( KnobStoreBuffer.Value() > 0 ) {
+        for (UINT32 tid = 0; tid < MAX_THREADS; tid++) {
+            storeBuffers.push_back(new STORE_BUFFER(KnobStoreBuffer.Value(),
+                                                    KnobLineSize.Value(),
+                                                    KnobStoreBufferDrain.Value()));
+        }
+    }
+    if( KnobWriteCombining.Value() > 0 ) {
+        if( KnobLineSize.Value() > 64 ) {
+            cerr << "wcb needs lines of at most 64 bytes" << endl;
+            return false;
+        }
+        for (UINT32 tid = 0; tid < MAX_THREADS; tid++) {
+            wcBuffers.push_back(new WRITE_COMBINING_BUFFER(KnobWriteCombining.Value(), KnobLineSize.Value()));
+            wcBuffers.back()->SetFlushFunction(WcFlush, 0);
+        }
+    }
+    return true;
+}
+
+static VOID DeleteModels()
+{
+    delete oracle;
+    delete numa;
+    delete tiers;
+    delete hotLines;
+    delete hotPages;
+    delete workingSet;
+    delete missRatioCurves;
+    delete sharing;
+    delete fieldHeat;
+    delete umon;
+    for (UINT32 tid = 0; tid < storeBuffers.size(); tid++) delete storeBuffers[tid];
+    for (UINT32 tid = 0; tid < wcBuffers.size(); tid++) delete wcBuffers[tid];
+
+    oracle = NULL;
+    numa = NULL;
+    tiers = NULL;
+    hotLines = hotPages = NULL;
+    workingSet = NULL;
+    missRatioCurves = NULL;
+    sharing = NULL;
+    fieldHeat = NULL;
+    umon = NULL;
+    storeBuffers.clear();
+    wcBuffers.clear();
+}
+
+/// Hook the miss-side models into dl1; the callbacks reach them through the globals
+static VOID ConnectModels()
+{
+    if( numa ) dl1->AddMissFunction(NumaMiss, 0);
+    if( tiers ) dl1->AddMissFunction(TierMiss, 0);
+    if( hotLines ) dl1->AddMissFunction(HotMiss, 0);
+    if( missRecorder ) {
+        dl1->AddMissFunction(MissStreamMiss, 0);
+        dl1->AddWritebackFunction(MissStreamWriteback, 0);
+    }
+    if( missProfile ) dl1->AddWritebackFunction(ProfileWriteback, 0);
+}
+
+/* ===================================================================== */
+
+static string OutputFileName()
+{
+    if( ! KnobFollow ) return KnobOutputFile.Value();
+    return KnobOutputFile.Value() + "." + decstr(PIN_GetPid());
+}
+
+/// Zero the cache counters and the per-instruction profile, keeping the cache contents
+static VOID ResetCounters()
+{
+    dl1->ResetStats();
+    if( baseline ) baseline->ResetStats();
+    for (UINT32 i = 0; i < shadows.size(); i++) shadows[i]->ResetStats();
+
+    for (UINT32 instId = 0; instId < instAddr.size(); instId++)
+    {
+        profile[instId][COUNTER_MISS] = 0;
+        profile[instId][COUNTER_HIT] = 0;
+    }
+}
+
+static BOOL StartLive();
+
+/*!
+ *  A forked child reports only its own references: models and counters
+ *  start over, the cache either cold or as warm as the parent left it.
+ *  Heap objects and remap ranges are inherited like the heap itself.
+ */
+VOID ForkBefore(THREADID tid, const CONTEXT * ctxt, VOID * v)
+{
+    // nothing buffered may be written twice
+    if( traceRecorder ) traceRecorder->Flush();
+    if( missRecorder ) missRecorder->Flush();
+}
+
+// set in a forked child whose models could not be rebuilt; it runs on
+// natively and writes no report
+volatile BOOL childAbandoned = false;
+
+static VOID AbandonChild(const char * what)
+{
+    cerr << "pid " << PIN_GetPid() << ": cannot " << what << " in the forked child, detaching" << endl;
+    childAbandoned = true;
+    PIN_Detach();
+}
+
+VOID ForkChild(THREADID tid, const CONTEXT * ctxt, VOID * v)
+{
+    outFile.close();
+    outFile.open(OutputFileName().c_str());
+
+    // a parent thread may have held any of the tool's locks at the fork,
+    // and only the forking thread lives on in the child: rebuilt models
+    // come with new locks, the global ones are initialized again below
+    DeleteModels();
+    if( ! CreateModels() ) {
+        AbandonChild("rebuild the models");
+        return;
+    }
+
+    if( ! KnobForkInherit ) {
+        DeleteCaches();
+        if( ! CreateCaches() ) {
+            AbandonChild("rebuild the caches");
+            return;
+        }
+        ConnectModels();
+
+        // the parent instrumented these instructions, the new dl1 never saw them
+        for (UINT32 instId = 0; instId < instAddr.size(); instId++) dl1->RegisterInstruction(instId);
+    }
+    ResetCounters();
+    if( patterns ) patterns->Reset();
+
+    // the parent's trace files, page and publisher thread stay with the parent
+    if( traceRecorder ) {
+        traceRecorder->Discard();
+        delete traceRecorder;
+        if( ! StartTrace() ) {
+            AbandonChild("open the trace");
+            return;
+        }
+    }
+    if( missRecorder ) {
+        missRecorder->Discard();
+        delete missRecorder;
+        if( ! StartMissTrace() ) {
+            AbandonChild("open the miss trace");
+            return;
+        }
+        missTime = 0;
+    }
+    if( ring ) {
+        PIN_InitLock(&ringLock);
+        for (UINT32 i = 0; i < MAX_THREADS; i++) ringBatches[i].clear();
+        delete ring;
+        if( ! StartRing() ) {
+            AbandonChild("create the ring");
+            return;
+        }
+    }
+    if( cloneProfile ) {
+        PIN_InitLock(&cloneLock);
+        delete cloneProfile;
+        cloneProfile = new CLONE_PROFILE(KnobLineSize.Value());
+    }
+    if( missProfile ) {
+        delete missProfile;
+        missProfile = new MISS_PROFILE(MAX_THREADS, KnobProfileStacks, KnobMissLatency.Value());
+    }
+
+    if( live ) {
+        delete live;
+        if( ! StartLive() ) {
+            AbandonChild("start the live page");
+            return;
+        }
+    }
+}
+
+/*!
+ *  Run the tool in exec'ed children as well; each writes its own report
+ */
+BOOL FollowExec(CHILD_PROCESS child, VOID * v)
+{
+    return true;
+}
+
+/* ===================================================================== */
+
+PIN_THREAD_UID livePublisherUid;
+volatile BOOL liveSnapshotRequested = false;
+volatile BOOL liveStop = false;
+
+static string LiveFileName()
+{
+    if( ! KnobFollow ) return KnobLive.Value();
+    return KnobLive.Value() + "." + decstr(PIN_GetPid());
+}
+
+/*!
+ *  Full report while the program runs.  The models' tables grow and are
+ *  cleared from analysis routines, so the application threads are stopped
+ *  while they are written and reset, and instrumentation is held off so
+ *  the instruction table stays put.  When the threads cannot be stopped
+ *  the request stays pending for the next period.
+ */
+static VOID LiveSnapshot()
+{
+    const THREADID tid = PIN_ThreadId();
+    if( ! PIN_StopApplicationThreads(tid) ) {
+        __atomic_store_n(&liveSnapshotRequested, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    const UINT64 number = live->Snapshot();
+    std::ofstream out((OutputFileName() + ".snapshot." + decstr(number)).c_str());
+
+    PIN_LockClient();
+    WriteStats(out);
+    if( KnobLiveReset ) {
+        ResetCounters();
+        live->Reset();
+    }
+    PIN_UnlockClient();
+
+    PIN_ResumeApplicationThreads(tid);
+}
+
+/*!
+ *  Internal thread: republish the page every -live_ms and write the
+ *  snapshots SIGUSR1 asked for
+ */
+static VOID LivePublisher(VOID * v)
+{
+    while( ! __atomic_load_n(&liveStop, __ATOMIC_RELAXED) ) {
+        PIN_Sleep(KnobLivePeriod.Value());
+        if( __atomic_exchange_n(&liveSnapshotRequested, false, __ATOMIC_RELAXED) ) LiveSnapshot();
+        live->Publish();
+    }
+}
+
+/*!
+ *  SIGUSR1 only flags the request, the publisher writes the snapshot.  The
+ *  signal still reaches the application if it installed a handler.
+ */
+static BOOL LiveSignal(THREADID tid, INT32 sig, CONTEXT * ctxt, BOOL hasHandler, const EXCEPTION_INFO * info, VOID * v)
+{
+    __atomic_store_n(&liveSnapshotRequested, true, __ATOMIC_RELAXED);
+    return hasHandler;
+}
+
+static VOID LivePrepareForFini(VOID * v)
+{
+    __atomic_store_n(&liveStop, true, __ATOMIC_RELAXED);
+    PIN_WaitForThreadTermination(livePublisherUid, PIN_INFINITE_TIMEOUT, NULL);
+}
+
+static BOOL StartLive()
+{
+    std::vector<string> levels;
+    levels.push_back("dl1");
+
+    live = new LIVE_STATS;
+    if( ! live->Open(LiveFileName(), levels, PIN_GetPid()) ) {
+        cerr << "cannot map live stats file " << LiveFileName() << endl;
+        return false;
+    }
+
+    liveStop = false;
+    return PIN_SpawnInternalThread(LivePublisher, 0, 0, &livePublisherUid) != INVALID_THREADID;
+}
+
+/* ===================================================================== */
+
+/*!
+ *  Pin does not call Fini after a detach; the report is written here
+ *  instead, the same way
+ */
+VOID DetachFini(VOID * v)
+{
+    if( childAbandoned ) return;
+    if( live ) LivePrepareForFini(0);
+    Fini(0, v);
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char *argv[])
+{
+    PIN_InitSymbols();
+
+    if( PIN_Init(argc,argv) )
+    {
+        return Usage();
+    }
+
+    outFile.open(OutputFileName().c_str());
+
+    if( KnobAccessPattern ) patterns = new ACCESS_PATTERN_TABLE;
+
+    if( ! KnobMissTrace.Value().empty() ) {
+        if( KnobSampleSets.Value() > 1 ) {
+            cerr << "-miss_trace needs every dl1 set simulated, not -sample_sets" << endl;
+            return Usage();
+        }
+        if( ! StartMissTrace() ) return Usage();
+    }
+
+    if( ! KnobPprof.Value().empty() || ! KnobFolded.Value().empty() ) {
+        if( MISS_PROFILE_SAMPLE::TypeByName(KnobFoldedValue.Value()) == MISS_PROFILE_SAMPLE::TYPES ) return Usage();
+        missProfile = new MISS_PROFILE(MAX_THREADS, KnobProfileStacks, KnobMissLatency.Value());
+    }
+
+    if( ! CreateModels() || ! CreateCaches() ) return Usage();
+    ConnectModels();
+
+    if( numa || sharing || fieldHeat ) allocSites = new ALLOC_SITES(MAX_THREADS);
+
+    if( ! KnobRemap.Value().empty() ) {
+        std::ifstream rules(KnobRemap.Value().c_str());
+        if( ! rules ) {
+            cerr << "cannot open remap file " << KnobRemap.Value() << endl;
+            return Usage();
+        }
+        remap = new ADDR_REMAP(MAX_THREADS);
+        const UINT32 badLine = remap->Read(rules);
+        if( badLine ) {
+            cerr << KnobRemap.Value() << ":" << badLine << ": bad remap rule" << endl;
+            return Usage();
+        }
+    }
+    
+    profile.SetKeyName("iaddr          ");
+    profile.SetCounterName("dcache:miss        dcache:hit");
+
+    COUNTER_HIT_MISS threshold;
+
+    threshold[COUNTER_HIT] = KnobThresholdHit.Value();
+    threshold[COUNTER_MISS] = KnobThresholdMiss.Value();
+    
+    profile.SetThreshold( threshold );
+    
+    if( ! KnobTrace.Value().empty() ) {
+        if( ! StartTrace() ) return Usage();
+    }
+    if( ! KnobClone.Value().empty() ) {
+        PIN_InitLock(&cloneLock);
+        cloneProfile = new CLONE_PROFILE(KnobLineSize.Value());
+    }
+    if( ! KnobRing.Value().empty() ) {
+        PIN_InitLock(&ringLock);
+        if( ! StartRing() ) return Usage();
+
+        if( ring->Consumers() < KnobRingWait.Value() ) {
+            cerr << "waiting for " << KnobRingWait.Value() << " consumers of " << TraceFileName(KnobRing.Value()) << endl;
+        }
+        while( ring->Consumers() < KnobRingWait.Value() ) usleep(10000);
+    }
+
+    if( allocSites || (remap && remap->HasSiteRules()) ) IMG_AddInstrumentFunction(ImageLoad, 0);
+    INS_AddInstrumentFunction(Instruction, 0);
+    PIN_AddFiniFunction(Fini, 0);
+    if( ! storeBuffers.empty() || ! wcBuffers.empty() ) PIN_AddThreadFiniFunction(ThreadFini, 0);
+
+    if( ! KnobStopRoutine.Value().empty() ) IMG_AddInstrumentFunction(StopImageLoad, 0);
+    if( KnobStopInstructions.Value() > 0 ) {
+        stopInstructions = KnobStopInstructions.Value();
+        TRACE_AddInstrumentFunction(Trace, 0);
+    }
+    if( ! KnobStopRoutine.Value().empty() || KnobStopInstructions.Value() > 0 || KnobStopMarker ) {
+        PIN_AddDetachFunction(DetachFini, 0);
+    }
+
+    if( KnobFollow ) {
+        PIN_AddForkFunction(FPOINT_BEFORE, ForkBefore, 0);
+        PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, ForkChild, 0);
+        PIN_AddFollowChildProcessFunction(FollowExec, 0);
+    }
+
+    if( ! KnobLive.Value().empty() ) {
+        if( ! StartLive() ) return Usage();
+        PIN_InterceptSignal(SIGUSR1, LiveSignal, 0);
+        PIN_AddPrepareForFiniFunction(LivePrepareForFini, 0);
+    }
 
     // Never returns
 
@@ -0,0 +1,151 @@
+/*! @file
+ *  This file contains the stand-alone generator for workload clones: it
+ *  reads a profile dcache -clone wrote and synthesizes a reference stream
+ *  with the same per-instruction mix, strides and reuse distances.
+ *
+ *      dcache_clone [-n refs] [-seed n] [-o out.trace] [-r report] profile
+ *
+ *  -n defaults to the number of profiled references; a few million are
+ *  usually enough for a stable curve.  -o writes the stream as a native
+ *  trace for dcache_replay.  The report compares the miss-ratio curve of
+ *  the profile with that of the generated stream.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include "pin_compat.H"
+#include "dcache.H"
+#include "dcache_trace.H"
+#include "clone_profile.H"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+static int Usage(const char * name)
+{
+    cerr << "usage: " << name << " [-n refs] [-seed n] [-o out.trace] [-r report] profile" << endl;
+    return 1;
+}
+
+/// Miss-ratio curves of the profile and the clone at every power-of-two size
+static string CurveTable(const CLONE_PROFILE & profile, const REUSE_DISTANCE & generated)
+{
+    UINT64 bins[REUSE::BINS];
+    UINT64 cold, refs;
+    profile.Totals(bins, cold, refs);
+
+    UINT32 used = REUSE::BINS;
+    while (used > 1 && bins[used - 1] == 0 && generated.Bins()[used - 1] == 0) used--;
+
+    string out = "#        lines       size-KB   profile-miss%   clone-miss%\n";
+    for (UINT32 k = 0; k < used; k++)
+    {
+        const UINT64 lines = UINT64(1) << k;
+        const FLT64 profileRatio = refs ? 100.0 * REUSE::Misses(bins, cold, k) / refs : 0;
+        const FLT64 cloneRatio = generated.Refs() ? 100.0 * generated.Misses(lines) / generated.Refs() : 0;
+        out += mydecstr(lines, 14) + "  " + fltstr(FLT64(lines) * profile.LineSize() / KILO, 2, 12) + "  " +
+               fltstr(profileRatio, 3, 14) + "  " + fltstr(cloneRatio, 3, 12) + "\n";
+    }
+    return out;
+}
+
+int main(int argc, char * argv[])
+{
+    UINT64 refs = 0;
+    UINT64 seed = 1;
+    string profileName, traceName, reportName;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-n" && hasValue) refs = strtoull(argv[++i], NULL, 0);
+        else if (arg == "-seed" && hasValue) seed = strtoull(argv[++i], NULL, 0);
+        else if (arg == "-o" && hasValue) traceName = argv[++i];
+        else if (arg == "-r" && hasValue) reportName = argv[++i];
+        else if (arg[0] == '-' || ! profileName.empty()) return Usage(argv[0]);
+        else profileName = arg;
+    }
+    if (profileName.empty()) return Usage(argv[0]);
+
+    std::ifstream in(profileName.c_str());
+    if (! in)
+    {
+        cerr << "cannot open profile " << profileName << endl;
+        return 1;
+    }
+    CLONE_PROFILE profile;
+    const UINT32 badLine = profile.Read(in);
+    if (badLine)
+    {
+        cerr << profileName << ":" << badLine << ": bad profile line" << endl;
+        return 1;
+    }
+
+    UINT64 bins[REUSE::BINS];
+    UINT64 cold, profiled;
+    profile.Totals(bins, cold, profiled);
+    if (refs == 0) refs = profiled;
+
+    CLONE_GENERATOR generator(profile, seed);
+    if (generator.Empty())
+    {
+        cerr << profileName << ": no instructions" << endl;
+        return 1;
+    }
+
+    const UINT32 chunkRefs = 65536;
+    TRACE_WRITER writer;
+    TRACE_CHUNK_ENCODER chunk(0);
+    if (! traceName.empty() && ! writer.Open(traceName, chunkRefs))
+    {
+        cerr << "cannot write trace " << traceName << endl;
+        return 1;
+    }
+
+    TRACE_REF ref;
+    ref.tid = 0;
+    for (UINT64 time = 0; time < refs; time++)
+    {
+        generator.Next(ref);
+        if (traceName.empty()) continue;
+
+        chunk.Add(time, ref.pc, ref.addr, ref.size, ref.store);
+        if (chunk.Refs() >= chunkRefs)
+        {
+            writer.Append(chunk);
+            chunk.Clear();
+        }
+    }
+    if (! traceName.empty())
+    {
+        writer.Append(chunk);
+        writer.Close();
+    }
+
+    std::ofstream reportFile;
+    if (! reportName.empty()) reportFile.open(reportName.c_str());
+    std::ostream & out = reportName.empty() ? cout : reportFile;
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+    out <<
+        "#\n"
+        "# CLONE stats\n"
+        "#\n";
+    out << "# " << ljstr("Instructions:     ", headerWidth) << mydecstr(profile.NumInsts(), numberWidth) << "\n";
+    out << "# " << ljstr("Profiled-Refs:    ", headerWidth) << mydecstr(profiled, numberWidth) << "\n";
+    out << "# " << ljstr("Generated-Refs:   ", headerWidth) << mydecstr(refs, numberWidth) << "\n";
+    out << "# " << ljstr("Generated-Lines:  ", headerWidth) << mydecstr(generator.Generated().Lines(), numberWidth) << "\n";
+    out << "# " << ljstr("Line-Size:        ", headerWidth) << mydecstr(profile.LineSize(), numberWidth) << "\n";
+    out <<
+        "#\n"
+        "# MISS RATIO CURVE (fully associative LRU)\n"
+        "#\n";
+    out << CurveTable(profile, generator.Generated());
+    return 0;
+}
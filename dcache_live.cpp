@@ -0,0 +1,120 @@
+/*! @file
+ *  This file contains a stand-alone reader for the page dcache -live
+ *  publishes while the program runs.
+ *
+ *      dcache_live [-i seconds] [-n count] dcache.live
+ *
+ *  Prints the counters once, or every -i seconds (-n times, default until
+ *  interrupted).  Reading maps the file read-only and takes no lock.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+typedef unsigned int UINT32;
+typedef unsigned long long UINT64;
+typedef UINT32 THREADID;
+typedef void VOID;
+using std::string;
+
+#include "live_stats.H"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::setw;
+
+static double Percent(UINT64 part, UINT64 whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void Print(const LIVE_STATS_PAGE & page)
+{
+    cout << "# pid " << page.pid << "  up " << std::fixed << std::setprecision(1)
+         << (page.updateNs - page.startNs) / 1e9 << "s  update " << page.sequence / 2
+         << "  snapshots " << page.snapshots << "  resets " << page.resets << "\n";
+    cout << "# refs/s " << page.refsPerSecond << " over the last " << std::setprecision(3)
+         << page.intervalNs / 1e9 << "s\n";
+
+    cout << "# level      load-acc   load-miss   store-acc  store-miss   miss-rate   interval-acc  interval-miss\n";
+    for (UINT32 level = 0; level < page.levels && level < LIVE_STATS_LEVELS; level++)
+    {
+        const LIVE_STATS_PAGE::LEVEL & l = page.level[level];
+        const UINT64 accesses = l.accesses[0] + l.accesses[1];
+        const UINT64 misses = l.misses[0] + l.misses[1];
+        cout << "  " << std::left << setw(8) << l.name << std::right
+             << setw(12) << l.accesses[0] << setw(12) << l.misses[0]
+             << setw(12) << l.accesses[1] << setw(12) << l.misses[1]
+             << setw(11) << std::setprecision(2) << Percent(misses, accesses) << "%"
+             << setw(15) << l.intervalAccesses[0] + l.intervalAccesses[1]
+             << setw(15) << l.intervalMisses[0] + l.intervalMisses[1] << "\n";
+    }
+
+    cout << "# thread     accesses      misses   miss-rate\n";
+    for (UINT32 tid = 0; tid < page.threads && tid < LIVE_STATS_THREADS; tid++)
+    {
+        const LIVE_STATS_PAGE::THREAD & t = page.thread[tid];
+        if (t.accesses == 0) continue;
+        cout << "  " << setw(6) << tid << setw(13) << t.accesses << setw(12) << t.misses
+             << setw(11) << Percent(t.misses, t.accesses) << "%\n";
+    }
+    cout << endl;
+}
+
+int main(int argc, char * argv[])
+{
+    double period = 0;
+    long count = -1;
+    const char * fileName = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const string arg = argv[i];
+        if (arg == "-i" && i + 1 < argc) period = atof(argv[++i]);
+        else if (arg == "-n" && i + 1 < argc) count = atol(argv[++i]);
+        else fileName = argv[i];
+    }
+    if (fileName == NULL)
+    {
+        cerr << "usage: " << argv[0] << " [-i seconds] [-n count] dcache.live" << endl;
+        return 1;
+    }
+
+    const int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "cannot open " << fileName << endl;
+        return 1;
+    }
+    const void * mapped = mmap(NULL, sizeof(LIVE_STATS_PAGE), PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        cerr << "cannot map " << fileName << endl;
+        return 1;
+    }
+    const LIVE_STATS_PAGE * page = static_cast<const LIVE_STATS_PAGE *>(mapped);
+
+    if (period <= 0) count = 1;
+    for (long printed = 0; count < 0 || printed < count; printed++)
+    {
+        if (printed > 0) usleep(useconds_t(period * 1e6));
+
+        LIVE_STATS_PAGE copy;
+        if (! ReadLiveStatsPage(page, copy))
+        {
+            cerr << fileName << ": no consistent live stats page" << endl;
+            return 1;
+        }
+        if (copy.version != LIVE_STATS_VERSION)
+        {
+            cerr << fileName << ": page version " << copy.version << ", expected " << LIVE_STATS_VERSION << endl;
+            return 1;
+        }
+        Print(copy);
+    }
+    return 0;
+}
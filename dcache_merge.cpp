@@ -0,0 +1,275 @@
+/*! @file
+ *  This file contains a stand-alone utility that merges the per-process
+ *  reports written by dcache -follow into one report.
+ *
+ *      dcache_merge [-o merged.out] [-min N] dcache.out.1234 dcache.out.1240 ...
+ *
+ *  Two kinds of lines are merged:
+ *   - counters "# Label:  <count> ..." are summed per section and block
+ *   - per-instruction rows "<image>+0x<offset> <count> <count> ..." are
+ *     summed per section and instruction over their leading count columns;
+ *     later columns are taken from the first report.  -follow reports key
+ *     these rows by image and offset, so exec'ed images and address space
+ *     randomization do not mix unrelated instructions, and write them
+ *     without the -rh/-rm thresholds; -min drops merged rows whose counts
+ *     all stay below N
+ *  Percentages, rows keyed by a raw "0x..." address, which means different
+ *  things in different processes, and every other table (intervals,
+ *  matrices, histograms) cannot be summed and are left out.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+
+using std::string;
+using std::vector;
+using std::map;
+using std::cerr;
+using std::endl;
+
+typedef unsigned long long UINT64;
+
+static bool IsCount(const string & token)
+{
+    if (token.empty()) return false;
+    for (size_t i = 0; i < token.size(); i++)
+    {
+        if (token[i] < '0' || token[i] > '9') return false;
+    }
+    return true;
+}
+
+/*!
+ *  @brief Everything merged from one "# SECTION" of the reports, in the
+ *  order it was first seen
+ */
+struct SECTION
+{
+    struct ROW
+    {
+        vector<string> tokens;  // first report's tokens, counts replaced by sums
+        vector<UINT64> counts;  // leading count columns after the PC
+    };
+
+    vector<string> counterKeys;             // "block\tlabel"
+    map<string, UINT64> counters;
+    string rowHeader;                       // column titles above the rows
+    vector<string> rowKeys;
+    map<string, ROW> rows;
+
+    static bool Kept(const ROW & row, UINT64 min)
+    {
+        for (size_t i = 0; i < row.counts.size(); i++)
+        {
+            if (row.counts[i] >= min) return true;
+        }
+        return row.counts.empty();
+    }
+
+    void AddCounter(const string & block, const string & label, UINT64 value)
+    {
+        const string key = block + "\t" + label;
+        if (counters.find(key) == counters.end()) counterKeys.push_back(key);
+        counters[key] += value;
+    }
+
+    void AddRow(const vector<string> & tokens)
+    {
+        std::map<string, ROW>::iterator it = rows.find(tokens[0]);
+        if (it == rows.end())
+        {
+            rowKeys.push_back(tokens[0]);
+            it = rows.insert(std::make_pair(tokens[0], ROW())).first;
+            it->second.tokens = tokens;
+        }
+
+        ROW & row = it->second;
+        for (size_t i = 1; i < tokens.size() && IsCount(tokens[i]); i++)
+        {
+            if (row.counts.size() < i) row.counts.resize(i, 0);
+            row.counts[i - 1] += strtoull(tokens[i].c_str(), NULL, 10);
+        }
+    }
+};
+
+class REPORT_MERGER
+{
+  private:
+    vector<string> _order;
+    map<string, SECTION> _sections;
+    unsigned _reports;
+    const UINT64 _min;
+
+    SECTION & Section(const string & name)
+    {
+        if (_sections.find(name) == _sections.end()) _order.push_back(name);
+        return _sections[name];
+    }
+
+  public:
+    REPORT_MERGER(UINT64 min) : _reports(0), _min(min) {}
+
+    bool Read(const char * fileName)
+    {
+        std::ifstream in(fileName);
+        if (! in) return false;
+        _reports++;
+
+        string section = "DCACHE stats";
+        string block;
+        string comment;
+        string line;
+        string previous[2];
+        while (std::getline(in, line))
+        {
+            // "#" / "# NAME" / "#" opens a section
+            if (line == "#" && previous[1] == "#" && previous[0].compare(0, 2, "# ") == 0)
+            {
+                section = previous[0].substr(2);
+                block.clear();
+            }
+            previous[1] = previous[0];
+            previous[0] = line;
+
+            if (line.compare(0, 2, "# ") == 0)
+            {
+                comment = line;
+
+                const string text = line.substr(2);
+                const size_t colon = text.find(':');
+                if (colon == string::npos) continue;
+
+                std::istringstream rest(text.substr(colon + 1));
+                string value;
+                if (! (rest >> value))
+                {
+                    block = text.substr(0, colon);      // "# L1 Data Cache:"
+                }
+                else if (IsCount(value))
+                {
+                    size_t end = colon;
+                    while (end > 0 && text[end - 1] == ' ') end--;
+                    size_t begin = 0;
+                    while (begin < end && text[begin] == ' ') begin++;
+                    Section(section).AddCounter(block, text.substr(begin, end - begin),
+                                                strtoull(value.c_str(), NULL, 10));
+                }
+                continue;
+            }
+
+            std::istringstream fields(line);
+            vector<string> tokens;
+            string token;
+            while (fields >> token) tokens.push_back(token);
+            if (! tokens.empty() && tokens[0].find("+0x") != string::npos)
+            {
+                SECTION & merged = Section(section);
+                if (merged.rowHeader.empty()) merged.rowHeader = comment;
+                merged.AddRow(tokens);
+            }
+        }
+        return true;
+    }
+
+    void Write(std::ostream & out) const
+    {
+        out << "PIN:MEMLATENCIES 1.0. 0x0\n";
+        out << "# merged from " << _reports << " process reports\n";
+
+        for (size_t s = 0; s < _order.size(); s++)
+        {
+            const SECTION & section = _sections.find(_order[s])->second;
+            if (section.counterKeys.empty() && section.rowKeys.empty()) continue;
+
+            out << "#\n# " << _order[s] << "\n#\n";
+
+            string block = "\t";
+            for (size_t i = 0; i < section.counterKeys.size(); i++)
+            {
+                const string & key = section.counterKeys[i];
+                const size_t tab = key.find('\t');
+                if (key.substr(0, tab) != block)
+                {
+                    block = key.substr(0, tab);
+                    if (! block.empty()) out << "# " << block << ":\n";
+                }
+
+                std::ostringstream label;
+                label.width(18);
+                label << std::left << (key.substr(tab + 1) + ":");
+                out << "# " << label.str() << " ";
+                out.width(12);
+                out << section.counters.find(key)->second << "\n";
+            }
+
+            if (! section.rowKeys.empty() && ! section.rowHeader.empty()) out << section.rowHeader << "\n";
+            for (size_t i = 0; i < section.rowKeys.size(); i++)
+            {
+                const SECTION::ROW & row = section.rows.find(section.rowKeys[i])->second;
+                if (! SECTION::Kept(row, _min)) continue;
+
+                std::ostringstream text;
+                text.width(19);
+                text << std::left << row.tokens[0] << std::right;
+                for (size_t t = 1; t < row.tokens.size(); t++)
+                {
+                    if (t > 1) text << "  ";
+                    if (t <= row.counts.size())
+                    {
+                        text.width(12);
+                        text << row.counts[t - 1];
+                    }
+                    else
+                    {
+                        text << row.tokens[t];
+                    }
+                }
+                out << text.str() << "\n";
+            }
+        }
+    }
+};
+
+int main(int argc, char * argv[])
+{
+    string outName;
+    UINT64 min = 0;
+    vector<const char *> inputs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "-o" && i + 1 < argc) outName = argv[++i];
+        else if (string(argv[i]) == "-min" && i + 1 < argc) min = strtoull(argv[++i], NULL, 10);
+        else inputs.push_back(argv[i]);
+    }
+    if (inputs.empty())
+    {
+        cerr << "usage: " << argv[0] << " [-o merged.out] [-min N] dcache.out.<pid> ..." << endl;
+        return 1;
+    }
+
+    REPORT_MERGER merger(min);
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        if (! merger.Read(inputs[i]))
+        {
+            cerr << "cannot read " << inputs[i] << endl;
+            return 1;
+        }
+    }
+
+    if (outName.empty())
+    {
+        merger.Write(std::cout);
+        return 0;
+    }
+
+    std::ofstream out(outName.c_str());
+    merger.Write(out);
+    return out ? 0 : 1;
+}
@@ -0,0 +1,892 @@
+/*! @file
+ *  This file contains a stand-alone replay simulator for traces recorded
+ *  with dcache -trace.
+ *
+ *      dcache_replay [options] trace
+ *
+ *  Chunks are decoded on -j threads and merged back into global time
+ *  order before they reach the cache.  Queries use the chunk index to
+ *  skip chunks that cannot match, so a narrow query does not read the
+ *  whole file:
+ *
+ *      -tid 0,3            references of these threads
+ *      -pc 0x4005d0,...    references of these instructions
+ *      -addr lo:hi         data addresses in [lo, hi)
+ *      -time lo:hi         reference sequence numbers in [lo, hi)
+ *
+ *  Instead of simulating, -extract writes the selected references to a
+ *  new trace, -dump prints them and -index prints the chunk index.
+ *
+ *  Dinero din and ChampSim traces (-format din|champsim, or recognized by
+ *  name, optionally .gz/.xz/.bz2) stream through a background decoder in
+ *  the same blocks; -size sets their reference size.  They have no index,
+ *  so they are read in full, and -extract converts them to the native
+ *  format.
+ *
+ *  A -miss_trace stream already went through the recorded L1: -c/-b/-a
+ *  then configure the level behind it, which sees the misses and
+ *  prefetches as loads or stores and the dirty writebacks as stores.
+ *
+ *  -corun replays several traces at once, each on its own core with a
+ *  private L1 (-c/-b/-a) and L2 (-l2), in front of one shared LLC (-llc).
+ *  -rate sets how many references each core issues relative to the
+ *  others, counted in references (-schedule refs) or in recorded time
+ *  (-schedule time).  Every core also feeds a solo LLC of its own, so the
+ *  report compares each workload's LLC misses with and without its
+ *  co-runners from the same run.  The run ends with the first trace.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <future>
+#include <chrono>
+#include <cstdlib>
+
+#include "pin_compat.H"
+#include "dcache.H"
+#include "dcache_trace.H"
+#include "trace_formats.H"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace DL1
+{
+    const UINT32 max_sets = 2 * KILO; // room for the 2048-set L2 behind dl1
+    const UINT32 max_associativity = 32;
+    const CACHE_ALLOC::STORE_ALLOCATION allocation = CACHE_ALLOC::STORE_ALLOCATE;
+
+    typedef CACHE_LRU(max_sets, max_associativity, allocation) CACHE;
+}
+
+namespace LLC
+{
+    const UINT32 max_sets = 8 * KILO; // 8 MB at 16 ways and 64 B lines
+    const UINT32 max_associativity = 32;
+    const CACHE_ALLOC::STORE_ALLOCATION allocation = CACHE_ALLOC::STORE_ALLOCATE;
+
+    typedef CACHE_LRU(max_sets, max_associativity, allocation) CACHE;
+}
+
+/* ===================================================================== */
+
+/*!
+ *  @brief Decodes the selected chunks in order of their first reference,
+ *  keeping up to jobs chunks in flight
+ */
+class CHUNK_PIPELINE
+{
+  private:
+    typedef std::vector<TRACE_REF> REFS;
+
+    const TRACE_READER & _reader;
+    std::vector<UINT32> _order;
+    UINT32 _jobs;
+    UINT32 _launched;
+    UINT32 _taken;
+    std::deque<std::future<REFS *> > _inFlight;
+
+    static REFS * Decode(const TRACE_READER * reader, UINT32 chunk)
+    {
+        REFS * refs = new REFS;
+        if (! reader->Decode(chunk, *refs))
+        {
+            cerr << "chunk " << chunk << " is corrupt" << endl;
+            exit(1);
+        }
+        return refs;
+    }
+
+    struct EARLIER
+    {
+        const TRACE_READER & reader;
+        EARLIER(const TRACE_READER & r) : reader(r) {}
+        bool operator()(UINT32 a, UINT32 b) const { return reader.Info(a).firstTime < reader.Info(b).firstTime; }
+    };
+
+  public:
+    CHUNK_PIPELINE(const TRACE_READER & reader, const TRACE_FILTER & filter, UINT32 jobs)
+      : _reader(reader), _jobs(jobs ? jobs : 1), _launched(0), _taken(0)
+    {
+        for (UINT32 chunk = 0; chunk < reader.NumChunks(); chunk++)
+        {
+            if (filter.Chunk(reader.Info(chunk))) _order.push_back(chunk);
+        }
+        std::stable_sort(_order.begin(), _order.end(), EARLIER(reader));
+    }
+
+    UINT32 Selected() const { return _order.size(); }
+    bool Done() const { return _taken == _order.size(); }
+    UINT64 NextFirstTime() const { return _reader.Info(_order[_taken]).firstTime; }
+
+    /// Next chunk in order, decoded; the caller deletes it
+    REFS * Take()
+    {
+        while (_launched < _order.size() && _launched < _taken + _jobs)
+        {
+            _inFlight.push_back(std::async(std::launch::async, Decode, &_reader, _order[_launched++]));
+        }
+        REFS * refs = _inFlight.front().get();
+        _inFlight.pop_front();
+        _taken++;
+        return refs;
+    }
+};
+
+/*!
+ *  @brief Merges the chunks of a pipeline into one reference stream in
+ *  time order.  A chunk runs until another one is due, so the heap is
+ *  only touched where threads interleave.
+ */
+class TIME_MERGE
+{
+  private:
+    struct CURSOR
+    {
+        std::vector<TRACE_REF> * refs;
+        UINT32 next;
+        UINT64 Time() const { return (*refs)[next].time; }
+    };
+    struct LATER
+    {
+        bool operator()(const CURSOR & a, const CURSOR & b) const { return a.Time() > b.Time(); }
+    };
+
+    CHUNK_PIPELINE & _pipeline;
+    std::priority_queue<CURSOR, std::vector<CURSOR>, LATER> _active;
+    CURSOR _current;
+    UINT64 _limit;
+
+  public:
+    TIME_MERGE(CHUNK_PIPELINE & pipeline) : _pipeline(pipeline), _limit(0)
+    {
+        _current.refs = NULL;
+        _current.next = 0;
+    }
+
+    ~TIME_MERGE()
+    {
+        delete _current.refs;
+        for (; ! _active.empty(); _active.pop()) delete _active.top().refs;
+    }
+
+    /// The next reference in time order, valid until the next call; NULL at the end
+    const TRACE_REF * Next()
+    {
+        if (_current.refs)
+        {
+            if (_current.next < _current.refs->size() && _current.Time() <= _limit)
+            {
+                return &(*_current.refs)[_current.next++];
+            }
+            if (_current.next < _current.refs->size()) _active.push(_current);
+            else delete _current.refs;
+            _current.refs = NULL;
+        }
+
+        // chunks that start before the earliest pending reference join the merge
+        while (! _pipeline.Done() && (_active.empty() || _pipeline.NextFirstTime() <= _active.top().Time()))
+        {
+            CURSOR cursor = { _pipeline.Take(), 0 };
+            if (cursor.refs->empty()) delete cursor.refs;
+            else _active.push(cursor);
+        }
+        if (_active.empty()) return NULL;
+
+        _current = _active.top();
+        _active.pop();
+
+        // run this chunk until another one is due
+        _limit = _active.empty() ? ~UINT64(0) : _active.top().Time();
+        if (! _pipeline.Done() && _pipeline.NextFirstTime() < _limit) _limit = _pipeline.NextFirstTime();
+
+        return &(*_current.refs)[_current.next++];
+    }
+};
+
+/// Hands the selected references of a native trace to a sink in time order
+template <class SINK>
+static UINT64 Replay(CHUNK_PIPELINE & pipeline, const TRACE_FILTER & filter, SINK & sink)
+{
+    TIME_MERGE merge(pipeline);
+    UINT64 selected = 0;
+    while (const TRACE_REF * ref = merge.Next())
+    {
+        if (filter.Ref(*ref))
+        {
+            sink(*ref);
+            selected++;
+        }
+    }
+    return selected;
+}
+
+/*!
+ *  @brief A native trace as a TRACE_SOURCE, so it can stream through a
+ *  BACKGROUND_READER like the foreign formats
+ */
+class NATIVE_SOURCE : public TRACE_SOURCE
+{
+  private:
+    TRACE_READER _reader;
+    CHUNK_PIPELINE * _pipeline;
+    TIME_MERGE * _merge;
+
+  public:
+    NATIVE_SOURCE() : _pipeline(NULL), _merge(NULL) {}
+    ~NATIVE_SOURCE()
+    {
+        delete _merge;
+        delete _pipeline;
+    }
+
+    bool Open(const string & fileName, UINT32 jobs)
+    {
+        if (! _reader.Open(fileName)) return false;
+        _pipeline = new CHUNK_PIPELINE(_reader, TRACE_FILTER(), jobs);
+        _merge = new TIME_MERGE(*_pipeline);
+        return true;
+    }
+
+    const char * Name() const { return "native"; }
+
+    bool Read(std::vector<TRACE_REF> & block, UINT32 refs)
+    {
+        for (; refs > 0; refs--)
+        {
+            const TRACE_REF * ref = _merge->Next();
+            if (ref == NULL) return false;
+            block.push_back(*ref);
+        }
+        return true;
+    }
+};
+
+/*!
+ *  Foreign formats: blocks arrive in reference order from the background
+ *  decoder
+ */
+template <class SINK>
+static UINT64 Replay(BACKGROUND_READER & reader, const TRACE_FILTER & filter, SINK & sink)
+{
+    UINT64 selected = 0;
+    while (std::vector<TRACE_REF> * block = reader.Take())
+    {
+        for (UINT32 i = 0; i < block->size(); i++)
+        {
+            const TRACE_REF & ref = (*block)[i];
+            if (filter.Ref(ref))
+            {
+                sink(ref);
+                selected++;
+            }
+        }
+        delete block;
+    }
+    return selected;
+}
+
+/* ===================================================================== */
+
+struct SIMULATE
+{
+    DL1::CACHE & dl1;
+    UINT64 kinds[TRACE_KINDS];
+
+    VOID operator()(const TRACE_REF & ref)
+    {
+        kinds[ref.kind < TRACE_KINDS ? UINT32(ref.kind) : UINT32(TRACE_DEMAND)]++;
+        const CACHE_BASE::ACCESS_TYPE type = ref.store ? CACHE_BASE::ACCESS_TYPE_STORE : CACHE_BASE::ACCESS_TYPE_LOAD;
+        // same single-line shortcut as the tool
+        if (ref.size <= 4) dl1.AccessSingleLine(ref.addr, type, ref.size);
+        else dl1.Access(ref.addr, ref.size, type);
+    }
+};
+
+/// Selected references into a new trace, one encoder per thread as when recording
+struct EXTRACT
+{
+    TRACE_WRITER & writer;
+    UINT32 chunkRefs;
+    std::vector<TRACE_CHUNK_ENCODER *> encoders;
+
+    VOID operator()(const TRACE_REF & ref)
+    {
+        if (ref.tid >= encoders.size()) encoders.resize(ref.tid + 1, (TRACE_CHUNK_ENCODER *) NULL);
+        TRACE_CHUNK_ENCODER *& encoder = encoders[ref.tid];
+        if (encoder == NULL) encoder = new TRACE_CHUNK_ENCODER(ref.tid);
+
+        encoder->Add(ref.time, ref.pc, ref.addr, ref.size, ref.store, TRACE_KIND(ref.kind));
+        if (encoder->Refs() >= chunkRefs)
+        {
+            writer.Append(*encoder);
+            encoder->Clear();
+        }
+    }
+
+    VOID Finish()
+    {
+        for (UINT32 tid = 0; tid < encoders.size(); tid++)
+        {
+            if (encoders[tid]) writer.Append(*encoders[tid]);
+            delete encoders[tid];
+        }
+        encoders.clear();
+        writer.Close();
+    }
+};
+
+struct DUMP
+{
+    std::ostream & out;
+
+    VOID operator()(const TRACE_REF & ref)
+    {
+        out << mydecstr(ref.time, 12) << "  " << mydecstr(ref.tid, 4) << "  " << StringFromAddrint(ref.pc) << "  "
+            << StringFromAddrint(ref.addr) << "  " << mydecstr(ref.size, 4) << "  "
+            << (ref.kind == TRACE_WRITEBACK ? "W" : ref.kind == TRACE_PREFETCH ? "P" : ref.store ? "S" : "L") << "\n";
+    }
+};
+
+static string IndexTable(const TRACE_READER & reader, const TRACE_FILTER & filter)
+{
+    string out = "# chunk   tid       refs    first-time     last-time  pc-range                               "
+                 "addr-range                             selected\n";
+    for (UINT32 chunk = 0; chunk < reader.NumChunks(); chunk++)
+    {
+        const TRACE_CHUNK_INFO & info = reader.Info(chunk);
+        out += mydecstr(chunk, 7) + "  " + mydecstr(info.tid, 4) + "  " + mydecstr(info.refs, 9) + "  " +
+               mydecstr(info.firstTime, 12) + "  " + mydecstr(info.lastTime, 12) + "  " +
+               StringFromAddrint(info.minPc) + "-" + StringFromAddrint(info.maxPc) + "  " +
+               StringFromAddrint(info.minAddr) + "-" + StringFromAddrint(info.maxAddr) + "  " +
+               (filter.Chunk(info) ? "yes" : "no") + "\n";
+    }
+    return out;
+}
+
+/* ===================================================================== */
+
+struct GEOMETRY
+{
+    UINT32 size;                // KB
+    UINT32 lineSize;
+    UINT32 associativity;
+};
+
+/*!
+ *  @brief One co-scheduled workload: its reference stream, its private L1
+ *  and L2, and a solo copy of the LLC that only its own L2 misses reach.
+ *  Only demand misses travel down the hierarchy.
+ */
+struct CORE
+{
+    string traceName;
+    FLT64 rate;
+    TRACE_SOURCE * source;
+    BACKGROUND_READER * reader;
+    std::vector<TRACE_REF> * block;
+    UINT32 next;
+    UINT64 firstTime;
+
+    DL1::CACHE * l1;
+    DL1::CACHE * l2;
+    LLC::CACHE * llc;           // shared
+    LLC::CACHE * solo;
+
+    UINT64 refs;
+    UINT64 l1Misses;
+    UINT64 l2Misses;
+    UINT64 llcMisses;
+    UINT64 soloMisses;
+
+    /// The next reference without consuming it; NULL at the end of the trace
+    const TRACE_REF * Peek()
+    {
+        while (block == NULL || next == block->size())
+        {
+            delete block;
+            block = reader->Take();
+            next = 0;
+            if (block == NULL) return NULL;
+            if (refs == 0 && ! block->empty()) firstTime = (*block)[0].time;
+        }
+        return &(*block)[next];
+    }
+
+    /// Virtual time the scheduler orders cores by
+    FLT64 Clock(bool byTime, const TRACE_REF & ref) const
+    {
+        return (byTime ? FLT64(ref.time - firstTime) : FLT64(refs)) / rate;
+    }
+
+    /// Estimated cycles: 1 per reference plus the latency of every level a miss reaches
+    FLT64 Cycles(UINT64 memoryAccesses, const UINT32 * latency) const
+    {
+        return FLT64(refs) + FLT64(l1Misses) * latency[0] + FLT64(l2Misses) * latency[1] +
+               FLT64(memoryAccesses) * latency[2];
+    }
+};
+
+static VOID CoreL1Miss(ADDRINT lineAddr, CACHE_BASE::ACCESS_TYPE type, UINT32, VOID * v)
+{
+    CORE * core = static_cast<CORE *>(v);
+    core->l1Misses++;
+    core->l2->Access(lineAddr, core->l1->LineSize(), type);
+}
+
+static VOID CoreL2Miss(ADDRINT lineAddr, CACHE_BASE::ACCESS_TYPE type, UINT32, VOID * v)
+{
+    CORE * core = static_cast<CORE *>(v);
+    core->l2Misses++;
+    if (! core->llc->Access(lineAddr, core->l2->LineSize(), type)) core->llcMisses++;
+    if (! core->solo->Access(lineAddr, core->l2->LineSize(), type)) core->soloMisses++;
+}
+
+/*!
+ *  Interleave the cores until the first trace ends: every step the core
+ *  with the smallest virtual clock issues its next reference
+ *  @return false if a trace could not be read
+ */
+static bool CoRun(std::vector<CORE> & cores, bool byTime, const TRACE_FILTER & filter)
+{
+    for (;;)
+    {
+        CORE * due = NULL;
+        FLT64 dueClock = 0;
+        for (UINT32 i = 0; i < cores.size(); i++)
+        {
+            const TRACE_REF * ref = cores[i].Peek();
+            if (ref == NULL) return cores[i].source->Error().empty();
+
+            const FLT64 clock = cores[i].Clock(byTime, *ref);
+            if (due == NULL || clock < dueClock)
+            {
+                due = &cores[i];
+                dueClock = clock;
+            }
+        }
+
+        const TRACE_REF & ref = (*due->block)[due->next++];
+        due->refs++;
+        if (! filter.Ref(ref)) continue;
+
+        const CACHE_BASE::ACCESS_TYPE type = ref.store ? CACHE_BASE::ACCESS_TYPE_STORE : CACHE_BASE::ACCESS_TYPE_LOAD;
+        if (ref.size <= 4) due->l1->AccessSingleLine(ref.addr, type, ref.size);
+        else due->l1->Access(ref.addr, ref.size, type);
+    }
+}
+
+static string GeometryName(const GEOMETRY & geometry)
+{
+    return decstr(geometry.size) + " KB, " + decstr(geometry.lineSize) + " B lines, " +
+           decstr(geometry.associativity) + "-way";
+}
+
+/*!
+ *  Power-of-two lines and sets, and no more sets or ways than the cache
+ *  type has room for; prints what is wrong with a bad geometry
+ */
+static bool CheckGeometry(const char * what, const GEOMETRY & geometry, UINT32 maxSets, UINT32 maxAssociativity)
+{
+    const UINT64 bytes = UINT64(geometry.size) * KILO;
+    const UINT64 setBytes = UINT64(geometry.lineSize) * geometry.associativity;
+    string error;
+    if (geometry.size == 0 || geometry.lineSize == 0 || geometry.associativity == 0) error = "needs a size, line size and associativity";
+    else if (! IsPower2(geometry.lineSize)) error = "needs a power-of-two line size";
+    else if (geometry.associativity > maxAssociativity) error = "allows at most " + decstr(maxAssociativity) + " ways";
+    else if (bytes % setBytes != 0 || bytes / setBytes == 0 || ! IsPower2(UINT32(bytes / setBytes)) || bytes / setBytes > maxSets)
+    {
+        error = "needs a power-of-two number of sets up to " + decstr(maxSets);
+    }
+    if (error.empty()) return true;
+
+    cerr << what << " of " << GeometryName(geometry) << " " << error << endl;
+    return false;
+}
+
+static string CoRunTable(const std::vector<CORE> & cores, const UINT32 * latency)
+{
+    string out = "# core    rate    references     l1-misses     l2-misses    llc-misses   solo-misses  "
+                 "increase%  slowdown  trace\n";
+    for (UINT32 i = 0; i < cores.size(); i++)
+    {
+        const CORE & core = cores[i];
+        const FLT64 increase = core.soloMisses ? 100.0 * (FLT64(core.llcMisses) - FLT64(core.soloMisses)) / core.soloMisses : 0;
+        const FLT64 soloCycles = core.Cycles(core.soloMisses, latency);
+        out += mydecstr(i, 6) + "  " + fltstr(core.rate, 2, 6) + "  " + mydecstr(core.refs, 12) + "  " +
+               mydecstr(core.l1Misses, 12) + "  " + mydecstr(core.l2Misses, 12) + "  " +
+               mydecstr(core.llcMisses, 12) + "  " + mydecstr(core.soloMisses, 12) + "  " +
+               fltstr(increase, 2, 9) + "  " + fltstr(soloCycles ? core.Cycles(core.llcMisses, latency) / soloCycles : 1, 3, 8) +
+               "  " + core.traceName + "\n";
+    }
+    return out;
+}
+
+template <class SINK>
+static UINT64 Run(CHUNK_PIPELINE * pipeline, BACKGROUND_READER * background, const TRACE_FILTER & filter, SINK & sink)
+{
+    return pipeline ? Replay(*pipeline, filter, sink) : Replay(*background, filter, sink);
+}
+
+/* ===================================================================== */
+
+// references per block of a foreign trace, as the tool's -trace_chunk default
+const UINT32 BLOCK_REFS = 65536;
+
+static string FormatByName(const string & name)
+{
+    if (name.find(".din") != string::npos) return "din";
+    if (name.find("champsim") != string::npos) return "champsim";
+    return "native";
+}
+
+static bool ParseRange(const string & text, UINT64 & lo, UINT64 & hi)
+{
+    const size_t colon = text.find(':');
+    if (colon == string::npos) return false;
+    lo = strtoull(text.substr(0, colon).c_str(), NULL, 0);
+    hi = strtoull(text.substr(colon + 1).c_str(), NULL, 0);
+    return lo < hi;
+}
+
+template <class T>
+static VOID ParseList(const string & text, std::set<T> & values)
+{
+    std::istringstream list(text);
+    string value;
+    while (std::getline(list, value, ',')) values.insert(T(strtoull(value.c_str(), NULL, 0)));
+}
+
+static int Usage(const char * name)
+{
+    cerr << "usage: " << name << " [-c KB] [-b line] [-a assoc] [-j threads] [-o out]\n"
+            "       [-tid list] [-pc list] [-addr lo:hi] [-time lo:hi]\n"
+            "       [-format native|din|champsim] [-size bytes]\n"
+            "       [-index | -dump | -extract out.trace] trace\n"
+            "   or: " << name << " -corun [-rate list] [-schedule refs|time] [-l2 KB] [-l2b line] [-l2a assoc]\n"
+            "       [-llc KB] [-llcb line] [-llca assoc] [-latency l2,llc,memory] [options] trace trace..." << endl;
+    return 1;
+}
+
+static VOID ParseNumbers(const string & text, std::vector<FLT64> & values)
+{
+    std::istringstream list(text);
+    string value;
+    while (std::getline(list, value, ',')) values.push_back(atof(value.c_str()));
+}
+
+struct CORUN_CONFIG
+{
+    GEOMETRY l1;
+    GEOMETRY l2;
+    GEOMETRY llc;
+    std::vector<FLT64> rates;   // per trace, missing ones are 1
+    bool byTime;
+    UINT32 latency[3];          // cycles to L2, LLC, memory
+};
+
+static int CoRunMain(const std::vector<string> & traceNames, const string & format, UINT32 size, UINT32 jobs,
+                     const CORUN_CONFIG & config, const TRACE_FILTER & filter, std::ostream & out)
+{
+    // far too large for the stack
+    LLC::CACHE * llc = new LLC::CACHE("Shared LLC", config.llc.size * KILO, config.llc.lineSize, config.llc.associativity,
+                                      2048 * 1024, 64, 16);
+
+    std::vector<CORE> cores(traceNames.size());
+    for (UINT32 i = 0; i < cores.size(); i++)
+    {
+        CORE & core = cores[i];
+        core.traceName = traceNames[i];
+        core.rate = i < config.rates.size() && config.rates[i] > 0 ? config.rates[i] : 1;
+
+        const string traceFormat = format.empty() ? FormatByName(core.traceName) : format;
+        bool opened;
+        if (traceFormat == "native")
+        {
+            NATIVE_SOURCE * native = new NATIVE_SOURCE;
+            opened = native->Open(core.traceName, jobs);
+            core.source = native;
+        }
+        else
+        {
+            if (traceFormat == "din") core.source = new DIN_SOURCE(size ? size : 4);
+            else if (traceFormat == "champsim") core.source = new CHAMPSIM_SOURCE(size ? size : 1);
+            else return 1;
+            opened = core.source->Open(core.traceName);
+        }
+        if (! opened)
+        {
+            cerr << "cannot read trace " << core.traceName << endl;
+            return 1;
+        }
+        core.reader = new BACKGROUND_READER(*core.source, BLOCK_REFS);
+        core.block = NULL;
+        core.next = 0;
+        core.firstTime = 0;
+        core.refs = core.l1Misses = core.l2Misses = core.llcMisses = core.soloMisses = 0;
+
+        core.l1 = new DL1::CACHE("Private L1", config.l1.size * KILO, config.l1.lineSize, config.l1.associativity,
+                                 2048 * 1024, 64, 16);
+        core.l2 = new DL1::CACHE("Private L2", config.l2.size * KILO, config.l2.lineSize, config.l2.associativity,
+                                 2048 * 1024, 64, 16);
+        core.llc = llc;
+        core.solo = new LLC::CACHE("Solo LLC", config.llc.size * KILO, config.llc.lineSize, config.llc.associativity,
+                                   2048 * 1024, 64, 16);
+        core.l1->AddMissFunction(CoreL1Miss, &core);
+        core.l2->AddMissFunction(CoreL2Miss, &core);
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const bool ok = CoRun(cores, config.byTime, filter);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    UINT64 refs = 0;
+    UINT64 llcMisses = 0;
+    for (UINT32 i = 0; i < cores.size(); i++)
+    {
+        if (! cores[i].source->Error().empty()) cerr << cores[i].traceName << ": " << cores[i].source->Error() << endl;
+        refs += cores[i].refs;
+        llcMisses += cores[i].llcMisses;
+    }
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+    out << "PIN:MEMLATENCIES 1.0. 0x0\n";
+    out <<
+        "#\n"
+        "# CORUN stats\n"
+        "#\n";
+    out << "# " << ljstr("Private-L1:       ", headerWidth) << GeometryName(config.l1) << "\n";
+    out << "# " << ljstr("Private-L2:       ", headerWidth) << GeometryName(config.l2) << "\n";
+    out << "# " << ljstr("Shared-LLC:       ", headerWidth) << GeometryName(config.llc) << "\n";
+    out << "# " << ljstr("Schedule:         ", headerWidth) << (config.byTime ? "time" : "refs") << "\n";
+    out << "# " << ljstr("Latencies:        ", headerWidth) << config.latency[0] << " L2, " << config.latency[1]
+        << " LLC, " << config.latency[2] << " memory cycles\n";
+    out << "# " << ljstr("References:       ", headerWidth) << mydecstr(refs, numberWidth) << "\n";
+    out << "# " << ljstr("LLC-Misses:       ", headerWidth) << mydecstr(llcMisses, numberWidth) << "\n";
+    out << "# " << ljstr("Refs/s:           ", headerWidth)
+        << mydecstr(UINT64(seconds > 0 ? refs / seconds : 0), numberWidth) << "\n";
+    out << "#\n";
+    out << CoRunTable(cores, config.latency);
+
+    for (UINT32 i = 0; i < cores.size(); i++)
+    {
+        CORE & core = cores[i];
+        delete core.block;
+        delete core.reader;
+        delete core.source;
+        delete core.l1;
+        delete core.l2;
+        delete core.solo;
+    }
+    delete llc;
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char * argv[])
+{
+    UINT32 cacheSize = 32;
+    UINT32 lineSize = 32;
+    UINT32 associativity = 4;
+    UINT32 jobs = 4;
+    UINT32 size = 0;
+    string outName, extractName, traceName, format;
+    std::vector<string> traceNames;
+    bool index = false, dump = false, corun = false;
+    TRACE_FILTER filter;
+
+    CORUN_CONFIG config;
+    config.l2.size = 256;
+    config.l2.lineSize = 64;
+    config.l2.associativity = 8;
+    config.llc.size = 2048;
+    config.llc.lineSize = 64;
+    config.llc.associativity = 16;
+    config.byTime = false;
+    config.latency[0] = 12;
+    config.latency[1] = 40;
+    config.latency[2] = 200;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-c" && hasValue) cacheSize = atoi(argv[++i]);
+        else if (arg == "-b" && hasValue) lineSize = atoi(argv[++i]);
+        else if (arg == "-a" && hasValue) associativity = atoi(argv[++i]);
+        else if (arg == "-j" && hasValue) jobs = atoi(argv[++i]);
+        else if (arg == "-o" && hasValue) outName = argv[++i];
+        else if (arg == "-tid" && hasValue) ParseList(argv[++i], filter.tids);
+        else if (arg == "-pc" && hasValue) ParseList(argv[++i], filter.pcs);
+        else if (arg == "-addr" && hasValue) { if (! ParseRange(argv[++i], filter.addrLo, filter.addrHi)) return Usage(argv[0]); }
+        else if (arg == "-time" && hasValue) { if (! ParseRange(argv[++i], filter.timeLo, filter.timeHi)) return Usage(argv[0]); }
+        else if (arg == "-extract" && hasValue) extractName = argv[++i];
+        else if (arg == "-format" && hasValue) format = argv[++i];
+        else if (arg == "-size" && hasValue) size = atoi(argv[++i]);
+        else if (arg == "-index") index = true;
+        else if (arg == "-dump") dump = true;
+        else if (arg == "-corun") corun = true;
+        else if (arg == "-rate" && hasValue) ParseNumbers(argv[++i], config.rates);
+        else if (arg == "-schedule" && hasValue) config.byTime = string(argv[++i]) == "time";
+        else if (arg == "-l2" && hasValue) config.l2.size = atoi(argv[++i]);
+        else if (arg == "-l2b" && hasValue) config.l2.lineSize = atoi(argv[++i]);
+        else if (arg == "-l2a" && hasValue) config.l2.associativity = atoi(argv[++i]);
+        else if (arg == "-llc" && hasValue) config.llc.size = atoi(argv[++i]);
+        else if (arg == "-llcb" && hasValue) config.llc.lineSize = atoi(argv[++i]);
+        else if (arg == "-llca" && hasValue) config.llc.associativity = atoi(argv[++i]);
+        else if (arg == "-latency" && hasValue)
+        {
+            std::vector<FLT64> latency;
+            ParseNumbers(argv[++i], latency);
+            if (latency.size() != 3) return Usage(argv[0]);
+            for (UINT32 level = 0; level < 3; level++) config.latency[level] = UINT32(latency[level]);
+        }
+        else if (arg[0] == '-') return Usage(argv[0]);
+        else traceNames.push_back(arg);
+    }
+    if (traceNames.empty() || (traceNames.size() > 1 && ! corun)) return Usage(argv[0]);
+    traceName = traceNames[0];
+
+    config.l1.size = cacheSize;
+    config.l1.lineSize = lineSize;
+    config.l1.associativity = associativity;
+    if (! CheckGeometry(corun ? "L1" : "Cache", config.l1, DL1::max_sets, DL1::max_associativity)) return Usage(argv[0]);
+
+    if (corun)
+    {
+        if (! CheckGeometry("L2", config.l2, DL1::max_sets, DL1::max_associativity) ||
+            ! CheckGeometry("LLC", config.llc, LLC::max_sets, LLC::max_associativity))
+        {
+            return Usage(argv[0]);
+        }
+        std::ofstream outFile;
+        if (! outName.empty()) outFile.open(outName.c_str());
+        return CoRunMain(traceNames, format, size, jobs, config, filter, outName.empty() ? cout : outFile);
+    }
+
+    if (format.empty()) format = FormatByName(traceName);
+
+    TRACE_READER reader;
+    TRACE_SOURCE * source = NULL;
+    if (format == "din") source = new DIN_SOURCE(size ? size : 4);
+    else if (format == "champsim") source = new CHAMPSIM_SOURCE(size ? size : 1);
+    else if (format != "native") return Usage(argv[0]);
+
+    if (source ? ! source->Open(traceName) : ! reader.Open(traceName))
+    {
+        cerr << "cannot read trace " << traceName << endl;
+        return 1;
+    }
+    if (reader.Recovered()) cerr << traceName << ": no index, recovered " << reader.NumChunks() << " chunks" << endl;
+
+    std::ofstream outFile;
+    if (! outName.empty()) outFile.open(outName.c_str());
+    std::ostream & out = outName.empty() ? cout : outFile;
+
+    if (index)
+    {
+        if (source)
+        {
+            cerr << format << " traces have no index" << endl;
+            return 1;
+        }
+        out << IndexTable(reader, filter);
+        return 0;
+    }
+
+    const UINT32 blockRefs = source ? BLOCK_REFS : reader.ChunkRefs();
+    CHUNK_PIPELINE * pipeline = source ? NULL : new CHUNK_PIPELINE(reader, filter, jobs);
+    BACKGROUND_READER * background = source ? new BACKGROUND_READER(*source, blockRefs) : NULL;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    UINT64 selected = 0;
+    UINT64 kinds[TRACE_KINDS] = { 0 };
+    DL1::CACHE * dl1 = NULL;
+    if (dump)
+    {
+        DUMP sink = { out };
+        selected = Run(pipeline, background, filter, sink);
+    }
+    else if (! extractName.empty())
+    {
+        TRACE_WRITER writer;
+        const TRACE_FILE_HEADER & header = reader.Header();
+        const bool missStream = ! source && reader.MissStream();
+        if (! writer.Open(extractName, blockRefs, missStream ? header.filterSize : 0,
+                          missStream ? header.filterLineSize : 0, missStream ? header.filterAssociativity : 0))
+        {
+            cerr << "cannot write trace " << extractName << endl;
+            return 1;
+        }
+        EXTRACT sink = { writer, blockRefs, std::vector<TRACE_CHUNK_ENCODER *>() };
+        selected = Run(pipeline, background, filter, sink);
+        sink.Finish();
+        cerr << "extracted " << selected << " references in " << writer.Chunks() << " chunks" << endl;
+    }
+    else
+    {
+        dl1 = new DL1::CACHE(! source && reader.MissStream() ? "Cache behind L1" : "L1 Data Cache",
+                             cacheSize * KILO, lineSize, associativity, 2048 * 1024, 64, 16);
+        SIMULATE sink = { *dl1, { 0 } };
+        selected = Run(pipeline, background, filter, sink);
+        std::copy(sink.kinds, sink.kinds + TRACE_KINDS, kinds);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (source && ! source->Error().empty())
+    {
+        cerr << traceName << ": " << source->Error() << endl;
+        return 1;
+    }
+    if (dl1 == NULL) return 0;
+
+    out << "PIN:MEMLATENCIES 1.0. 0x0\n";
+    out <<
+        "#\n"
+        "# DCACHE stats\n"
+        "#\n";
+    out << dl1->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+    out <<
+        "#\n"
+        "# REPLAY stats\n"
+        "#\n";
+    if (source)
+    {
+        out << "# " << ljstr("Format:           ", headerWidth) << source->Name() << "\n";
+        out << "# " << ljstr("Blocks:           ", headerWidth) << mydecstr(background->Blocks(), numberWidth) << "\n";
+        out << "# " << ljstr("Skipped-Records:  ", headerWidth) << mydecstr(source->Skipped(), numberWidth) << "\n";
+    }
+    else
+    {
+        out << "# " << ljstr("Chunks:           ", headerWidth) << mydecstr(reader.NumChunks(), numberWidth) << "\n";
+        out << "# " << ljstr("Chunks-Decoded:   ", headerWidth) << mydecstr(pipeline->Selected(), numberWidth) << "\n";
+        out << "# " << ljstr("References:       ", headerWidth) << mydecstr(reader.NumRefs(), numberWidth) << "\n";
+        out << "# " << ljstr("Decode-Threads:   ", headerWidth) << mydecstr(jobs, numberWidth) << "\n";
+    }
+    if (! source && reader.MissStream())
+    {
+        const TRACE_FILE_HEADER & header = reader.Header();
+        out << "# " << ljstr("Filtered-By-L1:   ", headerWidth) << header.filterSize / KILO << " KB, "
+            << header.filterLineSize << " B lines, " << header.filterAssociativity << "-way\n";
+        out << "# " << ljstr("Demand-Misses:    ", headerWidth) << mydecstr(kinds[TRACE_DEMAND], numberWidth) << "\n";
+        out << "# " << ljstr("Writebacks:       ", headerWidth) << mydecstr(kinds[TRACE_WRITEBACK], numberWidth) << "\n";
+        out << "# " << ljstr("Prefetches:       ", headerWidth) << mydecstr(kinds[TRACE_PREFETCH], numberWidth) << "\n";
+    }
+    out << "# " << ljstr("Selected:         ", headerWidth) << mydecstr(selected, numberWidth) << "\n";
+    out << "# " << ljstr("Refs/s:           ", headerWidth)
+        << mydecstr(UINT64(seconds > 0 ? selected / seconds : 0), numberWidth) << "\n";
+
+    delete dl1;
+    delete background;
+    delete source;
+    delete pipeline;
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*! @file
+ *  This file contains a stand-alone consumer of the reference ring dcache
+ *  -ring publishes while the program runs.
+ *
+ *      dcache_ring [-c KB] [-b line] [-a assoc] [-o out] [-tid list]
+ *                  [-addr lo:hi] [-dump] dcache.ring
+ *
+ *  Every consumer attaches to its own slot and simulates its own cache, so
+ *  several of them with different geometries run side by side on one
+ *  execution of the program.  Start them before the program (see the
+ *  tool's -ring_wait) to see every reference; a consumer that attaches
+ *  later sees the references published from then on.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <chrono>
+#include <cstdlib>
+
+#include "pin_compat.H"
+#include "dcache.H"
+#include "ref_ring.H"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace DL1
+{
+    const UINT32 max_sets = 2 * KILO; // room for the 2048-set L2 behind dl1
+    const UINT32 max_associativity = 32;
+    const CACHE_ALLOC::STORE_ALLOCATION allocation = CACHE_ALLOC::STORE_ALLOCATE;
+
+    typedef CACHE_LRU(max_sets, max_associativity, allocation) CACHE;
+}
+
+static bool ParseRange(const string & text, UINT64 & lo, UINT64 & hi)
+{
+    const size_t colon = text.find(':');
+    if (colon == string::npos) return false;
+    lo = strtoull(text.substr(0, colon).c_str(), NULL, 0);
+    hi = strtoull(text.substr(colon + 1).c_str(), NULL, 0);
+    return lo < hi;
+}
+
+static int Usage(const char * name)
+{
+    cerr << "usage: " << name << " [-c KB] [-b line] [-a assoc] [-o out] [-tid list] [-addr lo:hi] [-dump] ring" << endl;
+    return 1;
+}
+
+int main(int argc, char * argv[])
+{
+    UINT32 cacheSize = 32;
+    UINT32 lineSize = 32;
+    UINT32 associativity = 4;
+    string outName, ringName;
+    bool dump = false;
+    TRACE_FILTER filter;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-c" && hasValue) cacheSize = atoi(argv[++i]);
+        else if (arg == "-b" && hasValue) lineSize = atoi(argv[++i]);
+        else if (arg == "-a" && hasValue) associativity = atoi(argv[++i]);
+        else if (arg == "-o" && hasValue) outName = argv[++i];
+        else if (arg == "-tid" && hasValue)
+        {
+            std::istringstream list(argv[++i]);
+            string tid;
+            while (std::getline(list, tid, ',')) filter.tids.insert(UINT32(strtoul(tid.c_str(), NULL, 0)));
+        }
+        else if (arg == "-addr" && hasValue) { if (! ParseRange(argv[++i], filter.addrLo, filter.addrHi)) return Usage(argv[0]); }
+        else if (arg == "-dump") dump = true;
+        else if (arg[0] == '-' || ! ringName.empty()) return Usage(argv[0]);
+        else ringName = arg;
+    }
+    if (ringName.empty()) return Usage(argv[0]);
+
+    REF_RING ring;
+    if (! ring.Attach(ringName))
+    {
+        cerr << "cannot attach to ring " << ringName << " (not a ring, or all " << REF_RING_CONSUMERS
+             << " consumer slots taken)" << endl;
+        return 1;
+    }
+
+    std::ofstream outFile;
+    if (! outName.empty()) outFile.open(outName.c_str());
+    std::ostream & out = outName.empty() ? cout : outFile;
+
+    DL1::CACHE dl1("L1 Data Cache", cacheSize * KILO, lineSize, associativity, 2048 * 1024, 64, 16);
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    UINT64 consumed = 0;
+    UINT64 selected = 0;
+    UINT64 waits = 0;
+    bool producerGone = false;
+    while (! ring.Done())
+    {
+        const TRACE_REF * refs;
+        const UINT64 count = ring.Peek(refs);
+        if (count == 0)
+        {
+            // the producer never finishes if it is killed
+            if (++waits % 1024 == 0 && ring.ProducerGone())
+            {
+                producerGone = true;
+                break;
+            }
+            usleep(50);
+            continue;
+        }
+
+        for (UINT64 i = 0; i < count; i++)
+        {
+            const TRACE_REF & ref = refs[i];
+            if (! filter.Ref(ref)) continue;
+            selected++;
+
+            if (dump)
+            {
+                out << mydecstr(ref.time, 12) << "  " << mydecstr(ref.tid, 4) << "  " << StringFromAddrint(ref.pc) << "  "
+                    << StringFromAddrint(ref.addr) << "  " << mydecstr(ref.size, 4) << "  " << (ref.store ? "S" : "L") << "\n";
+                continue;
+            }
+
+            const CACHE_BASE::ACCESS_TYPE type = ref.store ? CACHE_BASE::ACCESS_TYPE_STORE : CACHE_BASE::ACCESS_TYPE_LOAD;
+            // same single-line shortcut as the tool
+            if (ref.size <= 4) dl1.AccessSingleLine(ref.addr, type, ref.size);
+            else dl1.Access(ref.addr, ref.size, type);
+        }
+        ring.Release(count);
+        consumed += count;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const UINT32 slot = ring.Slot();
+    ring.Detach();
+
+    if (producerGone) cerr << ringName << ": producer " << ring.ProducerPid() << " exited without finishing" << endl;
+    if (dump) return producerGone ? 1 : 0;
+
+    out << "PIN:MEMLATENCIES 1.0. 0x0\n";
+    out <<
+        "#\n"
+        "# DCACHE stats\n"
+        "#\n";
+    out << dl1.StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+    out <<
+        "#\n"
+        "# RING CONSUMER stats\n"
+        "#\n";
+    out << "# " << ljstr("Slot:             ", headerWidth) << mydecstr(slot, numberWidth) << "\n";
+    out << "# " << ljstr("Consumed:         ", headerWidth) << mydecstr(consumed, numberWidth) << "\n";
+    out << "# " << ljstr("Selected:         ", headerWidth) << mydecstr(selected, numberWidth) << "\n";
+    out << "# " << ljstr("Producer-Stalls:  ", headerWidth) << mydecstr(ring.Stalls(), numberWidth) << "\n";
+    out << "# " << ljstr("Refs/s:           ", headerWidth)
+        << mydecstr(UINT64(seconds > 0 ? consumed / seconds : 0), numberWidth) << "\n";
+    return producerGone ? 1 : 0;
+}